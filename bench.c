@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 199309L // clock_gettime
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#define WB2SVG_IMPLEMENTATION
+#include "wb2svg.h"
+
+
+#define MAX_SVG_SIZE (64 * 1024 * 1024)
+#define RUNS 20
+
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+// Best of RUNS conversions per options set. Runs are interleaved so that
+// frequency scaling and cache state affect both sets alike.
+static bool bench(wb2svg_img img, const wb2svg_options* options, int count, char* svg, int* svg_sizes, double* times) {
+    for (int i = 0; i < count; ++i) times[i] = -1;
+    for (int run = 0; run < RUNS; ++run) {
+        for (int i = 0; i < count; ++i) {
+            double start = now_seconds();
+            svg_sizes[i] = wb2svg_wb2svg_ex(img, &options[i], svg, MAX_SVG_SIZE);
+            double elapsed = now_seconds() - start;
+            if (svg_sizes[i] < 0) return false;
+            if (times[i] < 0 || elapsed < times[i]) times[i] = elapsed;
+        }
+    }
+    return true;
+}
+
+
+// Best of RUNS times of the curve fitting stage alone. Fits the same chains
+// wb2svg__trace_path fits with curve_tolerance set: traced with every pixel.
+static double bench_fit(wb2svg_img img, float tolerance) {
+    wb2svg_options options = wb2svg_default_options();
+    options.merge_runs = false;
+    wb2svg_paths chains;
+    if (wb2svg_trace(img, &options, &chains) < 0) return -1;
+
+    wb2svg__tracer t = { .opts = &options };
+    double best = -1;
+    for (int run = 0; run < RUNS; ++run) {
+        double start = now_seconds();
+        for (int i = 0; i < chains.count; ++i) {
+            t.points = chains.points + chains.offsets[i];
+            t.count = chains.offsets[i + 1] - chains.offsets[i];
+            if (t.count > 1 && !wb2svg__fit_curves(&t, tolerance)) {
+                best = -1;
+                goto done;
+            }
+        }
+        double elapsed = now_seconds() - start;
+        if (best < 0 || elapsed < best) best = elapsed;
+    }
+
+done:
+    wb2svg__free(t.curve);
+    wb2svg__free(t.params);
+    wb2svg__free(t.spans);
+    wb2svg_paths_free(&chains);
+    return best;
+}
+
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "USAGE: %s <file_path>...\n", argv[0]);
+        return 1;
+    }
+
+    char* svg = malloc(MAX_SVG_SIZE);
+
+    printf("%-40s %12s %12s %10s %10s %9s\n", "file", "lines (ms)", "curves (ms)", "lines (B)", "curves (B)", "fit cost");
+    for (int i = 1; i < argc; ++i) {
+        const char* file_path = argv[i];
+
+        int width, height;
+        wb2svg_rgba* pixels = (wb2svg_rgba*)stbi_load(file_path, &width, &height, NULL, 4);
+        if (pixels == NULL) {
+            fprintf(stderr, "ERROR: could not read %s\n", file_path);
+            continue;
+        }
+        wb2svg_img img = { .pixels = pixels, .width = width, .height = height };
+
+        wb2svg_options options[2] = { wb2svg_default_options(), wb2svg_default_options() };
+        options[0].curve_tolerance = 0.0f;
+        options[1].curve_tolerance = 1.0f;
+
+        int sizes[2];
+        double times[2];
+        double fit_time;
+        if (!bench(img, options, 2, svg, sizes, times)) {
+            fprintf(stderr, "ERROR: buffer size exceeded for %s\n", file_path);
+        } else if ((fit_time = bench_fit(img, options[1].curve_tolerance)) < 0) {
+            fprintf(stderr, "ERROR: could not fit curves for %s\n", file_path);
+        } else {
+            // Curve fitting share of the whole pipeline.
+            double cost = fit_time / times[1] * 100.0;
+            printf(
+                "%-40s %12.2f %12.2f %10d %10d %8.1f%%\n",
+                file_path, times[0] * 1000, times[1] * 1000, sizes[0], sizes[1], cost
+            );
+        }
+
+        stbi_image_free(pixels);
+    }
+
+    free(svg);
+    return 0;
+}
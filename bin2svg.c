@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WB2SVG_IMPLEMENTATION
+#include "wb2svg.h"
+
+
+static void write_to_file(void* context, void* data, int size) {
+    fwrite(data, 1, size, (FILE*)context);
+}
+
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "USAGE: %s <input.bin> <output.svg>\n", argv[0]);
+        return 1;
+    }
+
+    wb2svg_file file;
+    if (wb2svg_file_open(&file, argv[1]) < 0) {
+        fprintf(stderr, "ERROR: could not read %s\n", argv[1]);
+        return 1;
+    }
+
+    wb2svg_paths paths;
+    int result = wb2svg_bin_decode(file.data, file.size, &paths);
+    wb2svg_file_close(&file);
+    if (result < 0) {
+        fprintf(stderr, "ERROR: %s is not a valid wb2svg binary file\n", argv[1]);
+        return 1;
+    }
+
+    FILE* svg_file = fopen(argv[2], "w");
+    if (svg_file == NULL) {
+        fprintf(stderr, "ERROR: could not open %s\n", argv[2]);
+        wb2svg_paths_free(&paths);
+        return 1;
+    }
+    result = wb2svg_paths_to_svg_func(write_to_file, svg_file, &paths, NULL);
+    fclose(svg_file);
+    wb2svg_paths_free(&paths);
+    if (result < 0) {
+        fprintf(stderr, "ERROR: could not write %s\n", argv[2]);
+        return 1;
+    }
+    return 0;
+}
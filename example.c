@@ -5,6 +5,7 @@
 #include <stdint.h>
 
 #define STB_IMAGE_IMPLEMENTATION
+#define STBI_JPEG_THREADS 8
 #include "stb_image.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -14,38 +15,79 @@
 #include "wb2svg.h"
 
 
-#define MAX_SVG_SIZE (5 * 1024 * 1024)
+static void write_to_file(void* context, void* data, int size) {
+    fwrite(data, 1, size, (FILE*)context);
+}
+
+
+static int read_jpeg_rows(void* context, wb2svg_rgba* rows, int count) {
+    return stbi_jpeg_rows_read((stbi_jpeg_rows*)context, (stbi_uc*)rows, count) ? 0 : -1;
+}
 
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        fprintf(stderr, "USAGE: %s <file_path>\n", argv[0]);
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "USAGE: %s <file_path> [downscale]\n", argv[0]);
         return 1;
     }
 
     const char* file_path = argv[1];
+    wb2svg_options options = wb2svg_default_options();
+    options.downscale = argc == 3 ? atoi(argv[2]) : 1;
+    if (options.downscale < 1) {
+        fprintf(stderr, "ERROR: downscale must be a positive integer\n");
+        return 1;
+    }
 
-    int width, height;
-    wb2svg_rgba* pixels = (wb2svg_rgba*)stbi_load(file_path, &width, &height, NULL, 4);
-    if (pixels == NULL) {
+    // The file is mapped and decoded from the page cache, JPEGs with restart
+    // markers on several threads. They are then color-converted row by row
+    // straight into the strip tracer, without an RGBA copy of the whole
+    // image. They shrink by 2, 4 or 8 in the decoder, other factors and
+    // formats are box filtered by wb2svg.
+    wb2svg_file file;
+    if (wb2svg_file_open(&file, file_path) < 0) {
         fprintf(stderr, "ERROR: could not read %s\n", file_path);
         return 1;
     }
-    wb2svg_img img = { .pixels = pixels, .width = width, .height = height };
+    bool decoder_scale = options.downscale == 2 || options.downscale == 4 || options.downscale == 8;
+    if (decoder_scale) stbi_set_jpeg_scale_on_load(options.downscale);
+    int width, height;
+    wb2svg_img img = {0};
+    stbi_jpeg_rows* jpeg = stbi_jpeg_rows_open_from_memory(file.data, file.size, &width, &height);
+    if (jpeg != NULL && decoder_scale) options.downscale = 1;
+    if (jpeg == NULL) {
+        img.pixels = (wb2svg_rgba*)stbi_load_from_memory(file.data, file.size, &width, &height, NULL, 4);
+        if (img.pixels == NULL) {
+            fprintf(stderr, "ERROR: could not read %s\n", file_path);
+            wb2svg_file_close(&file);
+            return 1;
+        }
+        img.width = width;
+        img.height = height;
+    }
 
-    char* svg = malloc(MAX_SVG_SIZE);
-    if (wb2svg_wb2svg(img, svg, MAX_SVG_SIZE) < 0) {
-        fprintf(stderr, "ERROR: buffer size exceeded\n");
-        free(svg);
+    FILE* svg_file = fopen("out.svg", "w");
+    if (svg_file == NULL) {
+        fprintf(stderr, "ERROR: could not open out.svg\n");
+        stbi_jpeg_rows_close(jpeg);
         stbi_image_free(img.pixels);
+        wb2svg_file_close(&file);
         return 1;
     }
 
-    FILE* svg_file = fopen("out.svg", "w");
-    fprintf(svg_file, "%s", svg);
+    int result;
+    if (jpeg != NULL) {
+        result = wb2svg_wb2svg_strips_to_func(write_to_file, svg_file, read_jpeg_rows, jpeg, width, height, &options);
+    } else {
+        result = wb2svg_wb2svg_to_func(write_to_file, svg_file, img, &options);
+    }
     fclose(svg_file);
-
-    free(svg);
+    stbi_jpeg_rows_close(jpeg);
     stbi_image_free(img.pixels);
+    wb2svg_file_close(&file);
+    if (result < 0) {
+        fprintf(stderr, "ERROR: could not convert %s\n", file_path);
+        return 1;
+    }
     return 0;
 }
@@ -366,6 +366,11 @@ RECENT REVISION HISTORY:
 //    huge block of memory and spend disproportionate time decoding it. By
 //    default this is set to (1 << 24), which is 16777216, but that's still
 //    very big.
+//
+//  - If you define STBI_JPEG_THREADS to a thread count, baseline JPEGs
+//    loaded from memory that have restart markers are entropy decoded on
+//    up to that many threads, one run of restart intervals each (POSIX
+//    threads). Other JPEGs decode serially as before.
 
 #ifndef STBI_NO_STDIO
 #include <stdio.h>
@@ -503,6 +508,19 @@ STBIDEF int      stbi_is_16_bit          (char const *filename);
 STBIDEF int      stbi_is_16_bit_from_file(FILE *f);
 #endif
 
+// decode a JPEG up front, but resample and color-convert it row by row on
+// demand: only the component planes are held, never the whole 8-bit image.
+// rows are 4 components (RGBA), top to bottom regardless of the flip
+// setting. NULL if the file is not a JPEG. not available with STBI_NO_JPEG
+typedef struct stbi_jpeg_rows stbi_jpeg_rows;
+STBIDEF stbi_jpeg_rows *stbi_jpeg_rows_open_from_memory(stbi_uc const *buffer, int len, int *x, int *y);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_jpeg_rows *stbi_jpeg_rows_open(char const *filename, int *x, int *y);
+#endif
+// writes the next count rows to output, count*x*4 bytes; 0 past the last row
+STBIDEF int      stbi_jpeg_rows_read(stbi_jpeg_rows *rows, stbi_uc *output, int count);
+STBIDEF void     stbi_jpeg_rows_close(stbi_jpeg_rows *rows);
+
 
 
 // for image formats that explicitly notate that they have premultiplied alpha,
@@ -517,12 +535,18 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 // flip the image vertically, so the first pixel in the output array is the bottom left
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+// decode JPEGs at 1/denom of their size (2, 4 or 8; 1 for full size) with
+// reduced IDCTs, like libjpeg's scale_denom. sizes round up; other values
+// round down to the nearest of these. stbi_info still reports the full size
+STBIDEF void stbi_set_jpeg_scale_on_load(int denom);
+
 // as above, but only applies to images loaded on the thread that calls the function
 // this function is only available if your compiler supports thread-local variables;
 // calling it will fail to link if your compiler doesn't
 STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply);
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
+STBIDEF void stbi_set_jpeg_scale_on_load_thread(int denom);
 
 // ZLIB client - used by PNG, available for other purposes
 
@@ -1134,6 +1158,29 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static int stbi__jpeg_scale_on_load_global = 1;
+
+STBIDEF void stbi_set_jpeg_scale_on_load(int denom)
+{
+   stbi__jpeg_scale_on_load_global = denom;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__jpeg_scale_on_load  stbi__jpeg_scale_on_load_global
+#else
+static STBI_THREAD_LOCAL int stbi__jpeg_scale_on_load_local, stbi__jpeg_scale_on_load_set;
+
+STBIDEF void stbi_set_jpeg_scale_on_load_thread(int denom)
+{
+   stbi__jpeg_scale_on_load_local = denom;
+   stbi__jpeg_scale_on_load_set = 1;
+}
+
+#define stbi__jpeg_scale_on_load  (stbi__jpeg_scale_on_load_set       \
+                                   ? stbi__jpeg_scale_on_load_local  \
+                                   : stbi__jpeg_scale_on_load_global)
+#endif // STBI_THREAD_LOCAL
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1993,6 +2040,7 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+   int scale_shift; // blocks decode to 8 >> scale_shift pixels square
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
@@ -2523,6 +2571,53 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced IDCT for scaled decoding, as in libjpeg's jidctred.c: the
+// top-left n x n coefficients through an n-point IDCT, which samples the
+// 8-point one at the centers of n x n pixel groups. n is 1, 2 or 4.
+// constants are C(u) cos((2m+1) u pi / 2n) scaled by 4096; columns are
+// scaled back to coefficient range, rows remove the 4096 and the 1/4 of the
+// 2D transform, rounding and adding 128 on the way
+static void stbi__idct_reduced(stbi_uc *out, int out_stride, short data[64], int n)
+{
+   int i, tmp[16], *t;
+   const int bias = (1 << 13) + (128 << 14);
+
+   if (n == 1) {
+      // the 1/4 C(0)^2 = 1/8 DC gain, rounded
+      out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+   } else if (n == 2) {
+      for (i=0; i < 2; ++i) {
+         int e = data[i] * 2896, o = data[8+i] * 2896;
+         tmp[i]   = (e + o + 2048) >> 12;
+         tmp[2+i] = (e - o + 2048) >> 12;
+      }
+      for (i=0, t=tmp; i < 2; ++i, t += 2, out += out_stride) {
+         int e = t[0] * 2896 + bias, o = t[1] * 2896;
+         out[0] = stbi__clamp((e + o) >> 14);
+         out[1] = stbi__clamp((e - o) >> 14);
+      }
+   } else {
+      // even part from coefficients 0 and 2, odd part from 1 and 3
+      for (i=0; i < 4; ++i) {
+         short *d = data + i;
+         int e0 = (d[0] + d[16]) * 2896, e1 = (d[0] - d[16]) * 2896;
+         int o0 = d[8] * 3784 + d[24] * 1567, o1 = d[8] * 1567 - d[24] * 3784;
+         tmp[i]    = (e0 + o0 + 2048) >> 12;
+         tmp[4+i]  = (e1 + o1 + 2048) >> 12;
+         tmp[8+i]  = (e1 - o1 + 2048) >> 12;
+         tmp[12+i] = (e0 - o0 + 2048) >> 12;
+      }
+      for (i=0, t=tmp; i < 4; ++i, t += 4, out += out_stride) {
+         int e0 = (t[0] + t[2]) * 2896 + bias, e1 = (t[0] - t[2]) * 2896 + bias;
+         int o0 = t[1] * 3784 + t[3] * 1567, o1 = t[1] * 1567 - t[3] * 3784;
+         out[0] = stbi__clamp((e0 + o0) >> 14);
+         out[1] = stbi__clamp((e1 + o1) >> 14);
+         out[2] = stbi__clamp((e1 - o1) >> 14);
+         out[3] = stbi__clamp((e0 - o0) >> 14);
+      }
+   }
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2946,13 +3041,162 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// inverse transform a dequantized block into its place in the component
+// plane, block bx, by of the component
+static void stbi__jpeg_idct_put(stbi__jpeg *z, int n, int bx, int by, short data[64])
+{
+   int bs = 8 >> z->scale_shift, w2 = z->img_comp[n].w2;
+   stbi_uc *out = z->img_comp[n].data + w2*by*bs + bx*bs;
+   if (bs == 8)
+      z->idct_block_kernel(out, w2, data);
+   else
+      stbi__idct_reduced(out, w2, data, bs);
+}
+
+// decode and transform baseline MCU i, j: a single block for non-interleaved
+// scans, otherwise an mcu's worth of each component in order
+stbi_inline static int stbi__jpeg_decode_mcu(stbi__jpeg *z, int i, int j)
+{
+   int k,x,y;
+   STBI_SIMD_ALIGN(short, data[64]);
+   if (z->scan_n == 1) {
+      int n = z->order[0], ha = z->img_comp[n].ha;
+      if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+      stbi__jpeg_idct_put(z, n, i, j, data);
+      return 1;
+   }
+   for (k=0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      // scan out an mcu's worth of this component; that's just determined
+      // by the basic H and V specified for the component
+      for (y=0; y < z->img_comp[n].v; ++y) {
+         for (x=0; x < z->img_comp[n].h; ++x) {
+            int x2 = i*z->img_comp[n].h + x;
+            int y2 = j*z->img_comp[n].v + y;
+            int ha = z->img_comp[n].ha;
+            if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+            stbi__jpeg_idct_put(z, n, x2, y2, data);
+         }
+      }
+   }
+   return 1;
+}
+
+#ifdef STBI_JPEG_THREADS
+#include <pthread.h>
+
+// a thread takes a run of restart intervals at least this many MCUs long
+#ifndef STBI__JPEG_MCUS_PER_THREAD
+#define STBI__JPEG_MCUS_PER_THREAD 512
+#endif
+
+typedef struct
+{
+   stbi__jpeg *z;       // shared tables and component planes
+   stbi_uc **segments;  // start of each restart interval, then the end of the scan
+   int first, count;    // intervals to decode
+   int mcu_x, mcu_total;
+   int ok;
+} stbi__jpeg_worker;
+
+static void *stbi__jpeg_worker_run(void *arg)
+{
+   stbi__jpeg_worker *w = (stbi__jpeg_worker *) arg;
+   stbi__jpeg *z = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   stbi__context s;
+   int i, m, end;
+   w->ok = 0;
+   if (!z) return NULL;
+   // own bit reader and DC predictors over a private context
+   memcpy(z, w->z, sizeof(stbi__jpeg));
+   s = *w->z->s;
+   z->s = &s;
+   for (i=w->first; i < w->first + w->count; ++i) {
+      s.img_buffer = w->segments[i];
+      s.img_buffer_end = w->segments[i+1];
+      stbi__jpeg_reset(z);
+      m = i * z->restart_interval;
+      end = m + z->restart_interval < w->mcu_total ? m + z->restart_interval : w->mcu_total;
+      for (; m < end; ++m)
+         if (!stbi__jpeg_decode_mcu(z, m % w->mcu_x, m / w->mcu_x)) { STBI_FREE(z); return NULL; }
+   }
+   w->ok = 1;
+   STBI_FREE(z);
+   return NULL;
+}
+
+// decode the mcu_x * mcu_y MCUs of a baseline scan by splitting the entropy
+// coded data at its restart markers, intervals write disjoint blocks. returns
+// 0 with nothing consumed to decode serially instead: not in memory, too
+// small, markers missing or out of place, or a decoding error (the serial
+// pass then reports it as usual)
+static int stbi__jpeg_decode_parallel(stbi__jpeg *z, int mcu_x, int mcu_y)
+{
+   stbi__jpeg_worker workers[STBI_JPEG_THREADS];
+   pthread_t threads[STBI_JPEG_THREADS];
+   int started[STBI_JPEG_THREADS];
+   stbi_uc **segments, *p, *end;
+   int i, n, count, thread_count, ok = 1;
+   int total = mcu_x * mcu_y;
+
+   if (z->s->read_from_callbacks || !z->restart_interval) return 0;
+   count = (total + z->restart_interval - 1) / z->restart_interval;
+   thread_count = total / STBI__JPEG_MCUS_PER_THREAD;
+   if (thread_count > count) thread_count = count;
+   if (thread_count > STBI_JPEG_THREADS) thread_count = STBI_JPEG_THREADS;
+   if (thread_count < 2) return 0;
+
+   segments = (stbi_uc **) stbi__malloc_mad2(count + 1, sizeof(stbi_uc *), 0);
+   if (!segments) return 0;
+   p = z->s->img_buffer;
+   end = z->s->img_buffer_end;
+   n = 0;
+   segments[n++] = p;
+   for (;;) {
+      stbi_uc *q;
+      p = (stbi_uc *) memchr(p, 0xff, end - p);
+      if (!p) { p = end; break; }
+      for (q = p+1; q < end && *q == 0xff; ++q) ; // fill bytes
+      if (q == end) { p = end; break; }
+      if (*q == 0x00) { p = q+1; continue; } // stuffed zero
+      if (!STBI__RESTART(*q)) break; // marker that ends the scan
+      if (n == count || *q != 0xd0 + (n-1) % 8) { STBI_FREE(segments); return 0; }
+      segments[n++] = p = q+1;
+   }
+   if (n != count) { STBI_FREE(segments); return 0; }
+   segments[count] = p;
+
+   for (i=0; i < thread_count; ++i) {
+      workers[i].z = z;
+      workers[i].segments = segments;
+      workers[i].first = count * i / thread_count;
+      workers[i].count = count * (i+1) / thread_count - workers[i].first;
+      workers[i].mcu_x = mcu_x;
+      workers[i].mcu_total = total;
+      started[i] = i > 0 && pthread_create(&threads[i], NULL, stbi__jpeg_worker_run, &workers[i]) == 0;
+   }
+   for (i=0; i < thread_count; ++i)
+      if (!started[i]) stbi__jpeg_worker_run(&workers[i]);
+   for (i=0; i < thread_count; ++i) {
+      if (started[i]) pthread_join(threads[i], NULL);
+      ok &= workers[i].ok;
+   }
+   STBI_FREE(segments);
+   if (!ok) return 0;
+
+   // continue after the scan as the serial decoder would
+   stbi__jpeg_reset(z);
+   z->s->img_buffer = p;
+   return 1;
+}
+#endif // STBI_JPEG_THREADS
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
    if (!z->progressive) {
       if (z->scan_n == 1) {
          int i,j;
-         STBI_SIMD_ALIGN(short, data[64]);
          int n = z->order[0];
          // non-interleaved data, we just need to process one block at a time,
          // in trivial scanline order
@@ -2960,11 +3204,12 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          // component has, independent of interleaved MCU blocking and such
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
+#ifdef STBI_JPEG_THREADS
+         if (stbi__jpeg_decode_parallel(z, w, h)) return 1;
+#endif
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
-               int ha = z->img_comp[n].ha;
-               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               if (!stbi__jpeg_decode_mcu(z, i, j)) return 0;
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2977,25 +3222,13 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          }
          return 1;
       } else { // interleaved
-         int i,j,k,x,y;
-         STBI_SIMD_ALIGN(short, data[64]);
+         int i,j;
+#ifdef STBI_JPEG_THREADS
+         if (stbi__jpeg_decode_parallel(z, z->img_mcu_x, z->img_mcu_y)) return 1;
+#endif
          for (j=0; j < z->img_mcu_y; ++j) {
             for (i=0; i < z->img_mcu_x; ++i) {
-               // scan an interleaved mcu... process scan_n components in order
-               for (k=0; k < z->scan_n; ++k) {
-                  int n = z->order[k];
-                  // scan out an mcu's worth of this component; that's just determined
-                  // by the basic H and V specified for the component
-                  for (y=0; y < z->img_comp[n].v; ++y) {
-                     for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
-                        int ha = z->img_comp[n].ha;
-                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
-                     }
-                  }
-               }
+               if (!stbi__jpeg_decode_mcu(z, i, j)) return 0;
                // after all interleaved components, that's an interleaved MCU,
                // so now count down the restart interval
                if (--z->todo <= 0) {
@@ -3089,7 +3322,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct_put(z, n, i, j, data);
             }
          }
       }
@@ -3329,8 +3562,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
       // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      //
+      // scaled decoding shrinks each block, and so the planes, by 1 << scale_shift
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale_shift);
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3340,10 +3575,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         // coefficients are kept for every 8x8 block, whatever the scale
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3820,6 +4055,8 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+   int denom = stbi__jpeg_scale_on_load;
+   j->scale_shift = denom >= 8 ? 3 : denom >= 4 ? 2 : denom >= 2 ? 1 : 0;
    j->idct_block_kernel = stbi__idct_block;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
@@ -3862,169 +4099,196 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+typedef struct
 {
+   stbi__resample res_comp[4];
    int n, decode_n, is_rgb;
+} stbi__jpeg_output;
+
+// decode the whole image, but leave resample and color-convert to
+// stbi__jpeg_output_row; cleans up on failure
+static int stbi__jpeg_start_output(stbi__jpeg *z, stbi__jpeg_output *o, int req_comp)
+{
+   int k;
    z->s->img_n = 0; // make stbi__cleanup_jpeg safe
 
    // validate req_comp
-   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+   if (req_comp < 0 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
 
    // load a jpeg image from whichever source, but leave in YCbCr format
-   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return 0; }
+
+   // scaled decoding left smaller planes, the output shrinks with them
+   if (z->scale_shift) {
+      int d = (1 << z->scale_shift) - 1;
+      z->s->img_x = (z->s->img_x + d) >> z->scale_shift;
+      z->s->img_y = (z->s->img_y + d) >> z->scale_shift;
+      for (k=0; k < z->s->img_n; ++k) {
+         z->img_comp[k].x = (z->img_comp[k].x + d) >> z->scale_shift;
+         z->img_comp[k].y = (z->img_comp[k].y + d) >> z->scale_shift;
+      }
+   }
 
    // determine actual number of components to generate
-   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+   o->n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
-   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+   o->is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
 
-   if (z->s->img_n == 3 && n < 3 && !is_rgb)
-      decode_n = 1;
+   if (z->s->img_n == 3 && o->n < 3 && !o->is_rgb)
+      o->decode_n = 1;
    else
-      decode_n = z->s->img_n;
+      o->decode_n = z->s->img_n;
 
    // nothing to do if no components requested; check this now to avoid
    // accessing uninitialized coutput[0] later
-   if (decode_n <= 0) { stbi__cleanup_jpeg(z); return NULL; }
+   if (o->decode_n <= 0) { stbi__cleanup_jpeg(z); return 0; }
 
-   // resample and color-convert
-   {
-      int k;
-      unsigned int i,j;
-      stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
-
-      stbi__resample res_comp[4];
-
-      for (k=0; k < decode_n; ++k) {
-         stbi__resample *r = &res_comp[k];
-
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
-         r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-         r->ypos    = 0;
-         r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-         else                               r->resample = stbi__resample_row_generic;
-      }
+   for (k=0; k < o->decode_n; ++k) {
+      stbi__resample *r = &o->res_comp[k];
+
+      // allocate line buffer big enough for upsampling off the edges
+      // with upsample factor of 4
+      z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
+      if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__err("outofmem", "Out of memory"); }
+
+      r->hs      = z->img_h_max / z->img_comp[k].h;
+      r->vs      = z->img_v_max / z->img_comp[k].v;
+      r->ystep   = r->vs >> 1;
+      r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+      r->ypos    = 0;
+      r->line0   = r->line1 = z->img_comp[k].data;
+
+      if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+      else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+      else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+      else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+      else                               r->resample = stbi__resample_row_generic;
+   }
+   return 1;
+}
 
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
+// resample and color-convert the next row into out, o->n components per pixel
+static void stbi__jpeg_output_row(stbi__jpeg *z, stbi__jpeg_output *o, stbi_uc *out)
+{
+   int k, n = o->n, decode_n = o->decode_n, is_rgb = o->is_rgb;
+   unsigned int i;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+
+   for (k=0; k < decode_n; ++k) {
+      stbi__resample *r = &o->res_comp[k];
+      int y_bot = r->ystep >= (r->vs >> 1);
+      coutput[k] = r->resample(z->img_comp[k].linebuf,
+                               y_bot ? r->line1 : r->line0,
+                               y_bot ? r->line0 : r->line1,
+                               r->w_lores, r->hs);
+      if (++r->ystep >= r->vs) {
+         r->ystep = 0;
+         r->line0 = r->line1;
+         if (++r->ypos < z->img_comp[k].y)
+            r->line1 += z->img_comp[k].w2;
+      }
+   }
+   if (n >= 3) {
+      stbi_uc *y = coutput[0];
+      if (z->s->img_n == 3) {
+         if (is_rgb) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = y[i];
+               out[1] = coutput[1][i];
+               out[2] = coutput[2][i];
+               out[3] = 255;
+               out += n;
             }
-         }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
          } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+         }
+      } else if (z->s->img_n == 4) {
+         if (z->app14_color_transform == 0) { // CMYK
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               out[0] = stbi__blinn_8x8(coutput[0][i], m);
+               out[1] = stbi__blinn_8x8(coutput[1][i], m);
+               out[2] = stbi__blinn_8x8(coutput[2][i], m);
+               out[3] = 255;
+               out += n;
             }
+         } else if (z->app14_color_transform == 2) { // YCCK
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               out[0] = stbi__blinn_8x8(255 - out[0], m);
+               out[1] = stbi__blinn_8x8(255 - out[1], m);
+               out[2] = stbi__blinn_8x8(255 - out[2], m);
+               out += n;
+            }
+         } else { // YCbCr + alpha?  Ignore the fourth channel for now
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+         }
+      } else
+         for (i=0; i < z->s->img_x; ++i) {
+            out[0] = out[1] = out[2] = y[i];
+            out[3] = 255; // not used if n==3
+            out += n;
          }
+   } else {
+      if (is_rgb) {
+         if (n == 1)
+            for (i=0; i < z->s->img_x; ++i)
+               *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+         else {
+            for (i=0; i < z->s->img_x; ++i, out += 2) {
+               out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+               out[1] = 255;
+            }
+         }
+      } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+         for (i=0; i < z->s->img_x; ++i) {
+            stbi_uc m = coutput[3][i];
+            stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+            stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+            stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+            out[0] = stbi__compute_y(r, g, b);
+            out[1] = 255;
+            out += n;
+         }
+      } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+         for (i=0; i < z->s->img_x; ++i) {
+            out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+            out[1] = 255;
+            out += n;
+         }
+      } else {
+         stbi_uc *y = coutput[0];
+         if (n == 1)
+            for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+         else
+            for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
       }
-      stbi__cleanup_jpeg(z);
-      *out_x = z->s->img_x;
-      *out_y = z->s->img_y;
-      if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-      return output;
    }
 }
 
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+   unsigned int j;
+   stbi_uc *output;
+   stbi__jpeg_output o;
+
+   if (!stbi__jpeg_start_output(z, &o, req_comp)) return NULL;
+
+   // can't error after this so, this is safe
+   output = (stbi_uc *) stbi__malloc_mad3(o.n, z->s->img_x, z->s->img_y, 1);
+   if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+
+   // now go ahead and resample
+   for (j=0; j < z->s->img_y; ++j)
+      stbi__jpeg_output_row(z, &o, output + o.n * z->s->img_x * j);
+   stbi__cleanup_jpeg(z);
+   *out_x = z->s->img_x;
+   *out_y = z->s->img_y;
+   if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+   return output;
+}
+
 static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
    unsigned char* result;
@@ -4076,6 +4340,76 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
    STBI_FREE(j);
    return result;
 }
+
+struct stbi_jpeg_rows
+{
+   stbi__context s;
+   stbi__jpeg j;
+   stbi__jpeg_output o;
+   int y; // next row
+};
+
+static stbi_jpeg_rows *stbi__jpeg_rows_start(stbi_jpeg_rows *r, int *x, int *y)
+{
+   int i;
+   r->j.s = &r->s;
+   stbi__setup_jpeg(&r->j);
+   if (!stbi__jpeg_start_output(&r->j, &r->o, 4)) { STBI_FREE(r); return NULL; }
+   // progressive coefficients are already dequantized into the component planes
+   for (i=0; i < r->s.img_n; ++i) {
+      if (r->j.img_comp[i].raw_coeff) {
+         STBI_FREE(r->j.img_comp[i].raw_coeff);
+         r->j.img_comp[i].raw_coeff = 0;
+         r->j.img_comp[i].coeff = 0;
+      }
+   }
+   *x = r->s.img_x;
+   *y = r->s.img_y;
+   return r;
+}
+
+STBIDEF stbi_jpeg_rows *stbi_jpeg_rows_open_from_memory(stbi_uc const *buffer, int len, int *x, int *y)
+{
+   stbi_jpeg_rows *r = (stbi_jpeg_rows *) stbi__malloc(sizeof(stbi_jpeg_rows));
+   if (!r) return (stbi_jpeg_rows *) stbi__errpuc("outofmem", "Out of memory");
+   memset(r, 0, sizeof(stbi_jpeg_rows));
+   stbi__start_mem(&r->s, buffer, len);
+   return stbi__jpeg_rows_start(r, x, y);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_jpeg_rows *stbi_jpeg_rows_open(char const *filename, int *x, int *y)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   stbi_jpeg_rows *r;
+   if (!f) return (stbi_jpeg_rows *) stbi__errpuc("can't fopen", "Unable to open file");
+   r = (stbi_jpeg_rows *) stbi__malloc(sizeof(stbi_jpeg_rows));
+   if (r) {
+      memset(r, 0, sizeof(stbi_jpeg_rows));
+      stbi__start_file(&r->s, f);
+      r = stbi__jpeg_rows_start(r, x, y); // the whole stream is consumed here
+   } else
+      stbi__err("outofmem", "Out of memory");
+   fclose(f);
+   return r;
+}
+#endif
+
+STBIDEF int stbi_jpeg_rows_read(stbi_jpeg_rows *r, stbi_uc *output, int count)
+{
+   int i;
+   if (count < 0 || count > (int) r->s.img_y - r->y) return stbi__err("bad count", "Read past the last row");
+   for (i=0; i < count; ++i, ++r->y)
+      stbi__jpeg_output_row(&r->j, &r->o, output + (size_t) 4 * r->s.img_x * i);
+   return 1;
+}
+
+STBIDEF void stbi_jpeg_rows_close(stbi_jpeg_rows *r)
+{
+   if (!r) return;
+   stbi__cleanup_jpeg(&r->j);
+   STBI_FREE(r);
+}
 #endif
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
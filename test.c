@@ -0,0 +1,987 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int malloc_count = 0;
+
+static void* counting_malloc(size_t size) {
+    malloc_count++;
+    return malloc(size);
+}
+
+static void* counting_realloc(void* pointer, size_t size) {
+    malloc_count++;
+    return realloc(pointer, size);
+}
+
+#define WB2SVG_MALLOC(size)           counting_malloc(size)
+#define WB2SVG_REALLOC(pointer, size) counting_realloc(pointer, size)
+#define WB2SVG_FREE(pointer)          free(pointer)
+#define WB2SVG_SVGZ
+#define WB2SVG_PDF
+#define WB2SVG_IMPLEMENTATION
+#include "wb2svg.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+
+#define RED   (wb2svg_rgba){ .r = 255, .g = 0, .b = 0, .a = 255 }
+#define BLUE  (wb2svg_rgba){ .r = 0, .g = 0, .b = 255, .a = 255 }
+#define WHITE (wb2svg_rgba){ .r = 255, .g = 255, .b = 255, .a = 255 }
+
+
+static wb2svg_img white_img(int width, int height) {
+    wb2svg_img img = wb2svg_img_alloc(width, height);
+    for (int i = 0; i < width*height; ++i) img.pixels[i] = WHITE;
+    return img;
+}
+
+
+// A speckle below min_component_size gets no nodes or edges.
+static void test_graph_skips_speckles(void) {
+    wb2svg_img img = white_img(16, 8);
+    for (int x = 2; x < 12; ++x) img.pixels[2*img.width + x] = RED;
+    img.pixels[6*img.width + 14] = RED;
+
+    wb2svg_components components;
+    CHECK(wb2svg_label_components(img, &components) == 0);
+    CHECK(components.count == 2);
+    int speckle = components.labels[6*img.width + 14];
+
+    wb2svg_graph graph;
+    CHECK(wb2svg_graph_build(img, &components, 3, &graph) == 0);
+    CHECK(graph.node_count == 2);
+    CHECK(graph.edge_count == 1);
+    for (int i = 0; i < graph.node_count; ++i) CHECK(graph.nodes[i].component != speckle);
+    for (int i = 0; i < graph.edge_count; ++i) CHECK(graph.edges[i].component != speckle);
+    wb2svg_graph_free(&graph);
+
+    CHECK(wb2svg_graph_build(img, &components, 0, &graph) == 0);
+    CHECK(graph.node_count == 3);
+    wb2svg_graph_free(&graph);
+
+    wb2svg_components_free(&components);
+    wb2svg_img_free(&img);
+}
+
+
+// Dots thinned down to a single pixel keep their color.
+static void test_dot_keeps_color(void) {
+    wb2svg_options options = wb2svg_default_options();
+    options.min_component_size = 0;
+    for (int size = 2; size <= 7; ++size) {
+        wb2svg_img img = white_img(24, 24);
+        for (int y = 8; y < 8 + size; ++y) {
+            for (int x = 8; x < 8 + size; ++x) img.pixels[y*img.width + x] = RED;
+        }
+
+        wb2svg_paths paths;
+        CHECK(wb2svg_trace(img, &options, &paths) == 0);
+        CHECK(paths.count == 1);
+        for (int i = 0; i < paths.count; ++i) {
+            CHECK(paths.colors[i].r == 255 && paths.colors[i].g == 0 && paths.colors[i].b == 0);
+        }
+        wb2svg_paths_free(&paths);
+        wb2svg_img_free(&img);
+    }
+}
+
+
+// With an arena set nothing comes from WB2SVG_MALLOC, memory stats included.
+static void test_arena_takes_all(void) {
+    wb2svg_img img = white_img(64, 64);
+    for (int i = 0; i < 40; ++i) img.pixels[(10 + i)*img.width + 10 + i] = RED;
+
+    size_t size = 4*1024*1024;
+    void* block = malloc(size);
+    wb2svg_arena arena;
+    wb2svg_arena_init(&arena, block, size);
+    wb2svg_memory_stats stats = {0};
+
+    int before = malloc_count;
+    wb2svg_arena* previous_arena = wb2svg_set_arena(&arena);
+    wb2svg_memory_stats* previous_stats = wb2svg_set_memory_stats(&stats);
+    wb2svg_paths paths;
+    CHECK(wb2svg_trace(img, NULL, &paths) == 0);
+    CHECK(paths.count == 1);
+    wb2svg_paths_free(&paths);
+    wb2svg_set_memory_stats(previous_stats);
+    wb2svg_set_arena(previous_arena);
+    CHECK(malloc_count == before);
+    CHECK(stats.peak > 0 && stats.current == 0);
+    CHECK(stats.in_arena);
+
+    wb2svg_memory_stats_free(&stats);
+    free(block);
+    wb2svg_img_free(&img);
+}
+
+
+// Lines, a diagonal and a ring at coordinates of 1-3 digits.
+static wb2svg_img shapes_img(void) {
+    wb2svg_img img = white_img(320, 200);
+    for (int x = 5; x < 300; ++x) img.pixels[10*img.width + x] = RED;
+    for (int y = 20; y < 190; ++y) img.pixels[y*img.width + 7] = RED;
+    for (int i = 0; i < 150; ++i) img.pixels[(30 + i)*img.width + 20 + i] = RED;
+    for (int y = 0; y < img.height; ++y) {
+        for (int x = 0; x < img.width; ++x) {
+            int dx = x - 240, dy = y - 110, r2 = dx*dx + dy*dy;
+            if (r2 >= 50*50 && r2 <= 53*53) img.pixels[y*img.width + x] = RED;
+        }
+    }
+    return img;
+}
+
+
+// Points of SVG path data, as written by wb2svg: integers and the M, L, H,
+// V and C commands, absolute or relative, with implicit repetition.
+static int parse_path_data(const char* d, wb2svg_point* points, int capacity) {
+    int count = 0, x = 0, y = 0;
+    char command = 0;
+    while (*d && *d != '"') {
+        if (*d == ' ') {
+            d++;
+        } else if (strchr("MmLlHhVvCc", *d)) {
+            command = *d++;
+        } else {
+            int arity = strchr("HhVv", command) ? 1 : strchr("Cc", command) ? 6 : 2;
+            int args[6];
+            for (int i = 0; i < arity; ++i) {
+                while (*d == ' ') d++;
+                args[i] = (int)strtol(d, (char**)&d, 10);
+            }
+            bool relative = command >= 'a';
+            int x0 = relative ? x : 0, y0 = relative ? y : 0;
+            switch (command | 0x20) {
+            case 'h': x = x0 + args[0]; break;
+            case 'v': y = y0 + args[0]; break;
+            case 'c':
+                for (int i = 0; i < 4; i += 2) {
+                    if (count < capacity) points[count] = (wb2svg_point){ x0 + args[i], y0 + args[i + 1] };
+                    count++;
+                }
+                x = x0 + args[4];
+                y = y0 + args[5];
+                break;
+            default:
+                x = x0 + args[0];
+                y = y0 + args[1];
+                if (command == 'M') command = 'L';
+                if (command == 'm') command = 'l';
+                break;
+            }
+            if (count < capacity) points[count] = (wb2svg_point){ x, y };
+            count++;
+        }
+    }
+    return count;
+}
+
+
+// Compact path data parses back to the traced points, polylines and curves.
+static void test_path_data_round_trip(void) {
+    wb2svg_img img = shapes_img();
+    size_t size = 1 << 20;
+    char* svg = malloc(size);
+    wb2svg_point* points = malloc(4096*sizeof(wb2svg_point));
+
+    for (int mode = 0; mode < 3; ++mode) {
+        wb2svg_options options = wb2svg_default_options();
+        options.merge_runs = mode != 1;
+        options.curve_tolerance = mode == 2 ? 1.0f : 0.0f;
+        wb2svg_paths paths;
+        CHECK(wb2svg_trace(img, &options, &paths) == 0);
+        CHECK(paths.count >= 4);
+        CHECK(wb2svg_paths_to_svg(&paths, &options, svg, (int)size) > 0);
+
+        const char* d = svg;
+        for (int i = 0; i < paths.count; ++i) {
+            d = strstr(d, " d=\"");
+            CHECK(d != NULL);
+            if (d == NULL) break;
+            d += 4;
+            int count = paths.offsets[i + 1] - paths.offsets[i];
+            CHECK(parse_path_data(d, points, 4096) == count);
+            CHECK(memcmp(points, paths.points + paths.offsets[i], count*sizeof(wb2svg_point)) == 0);
+        }
+        wb2svg_paths_free(&paths);
+    }
+
+    free(points);
+    free(svg);
+    wb2svg_img_free(&img);
+}
+
+
+static bool same_paths(const wb2svg_paths* a, const wb2svg_paths* b) {
+    if (a->width != b->width || a->height != b->height) return false;
+    if (a->count != b->count || a->point_count != b->point_count) return false;
+    for (int i = 0; i < a->count; ++i) {
+        wb2svg_rgba x = a->colors[i], y = b->colors[i];
+        if (x.r != y.r || x.g != y.g || x.b != y.b || a->kinds[i] != b->kinds[i]) return false;
+    }
+    return memcmp(a->offsets, b->offsets, (a->count + 1)*sizeof(int)) == 0
+        && memcmp(a->points, b->points, a->point_count*sizeof(wb2svg_point)) == 0;
+}
+
+
+// Binary paths decode to what was encoded, with more colors than fit a byte.
+static void test_bin_round_trip(void) {
+    int count = 300;
+    wb2svg_paths paths;
+    CHECK(wb2svg__alloc_paths(&paths, 5000, 3000, count, count*4));
+    for (int i = 0; i < count; ++i) {
+        paths.offsets[i] = i*4;
+        paths.colors[i] = (wb2svg_rgba){ .r = (uint8_t)i, .g = (uint8_t)(i*7 >> 2), .b = (uint8_t)(i >> 8), .a = 255 };
+        paths.kinds[i] = i % 3 == 0 ? WB2SVG_PATH_CUBIC : WB2SVG_PATH_LINES;
+        for (int j = 0; j < 4; ++j) {
+            paths.points[i*4 + j] = (wb2svg_point){ (i*37 + j*911) % 5000, (i*53 + j*1999) % 3000 };
+        }
+    }
+    paths.offsets[count] = count*4;
+
+    size_t size = 64*1024;
+    char* buffer = malloc(size);
+    int length = wb2svg_paths_to_bin(&paths, buffer, (int)size);
+    CHECK(length > 0);
+    wb2svg_paths decoded;
+    CHECK(wb2svg_bin_decode(buffer, length, &decoded) == 0);
+    CHECK(same_paths(&paths, &decoded));
+    wb2svg_paths_free(&decoded);
+    // Truncated data is rejected.
+    CHECK(wb2svg_bin_decode(buffer, length - 1, &decoded) < 0);
+    wb2svg_paths_free(&paths);
+
+    wb2svg_img img = shapes_img();
+    CHECK(wb2svg_trace(img, NULL, &paths) == 0);
+    length = wb2svg_paths_to_bin(&paths, buffer, (int)size);
+    CHECK(length > 0);
+    CHECK(wb2svg_bin_decode(buffer, length, &decoded) == 0);
+    CHECK(same_paths(&paths, &decoded));
+    wb2svg_paths_free(&decoded);
+    wb2svg_paths_free(&paths);
+    wb2svg_img_free(&img);
+    free(buffer);
+}
+
+
+typedef struct {
+    char* data;
+    int size;
+    int capacity;
+} output;
+
+
+static void write_to_output(void* context, void* data, int size) {
+    output* out = (output*)context;
+    if (out->size + size > out->capacity) {
+        out->capacity = 2*(out->size + size);
+        out->data = realloc(out->data, out->capacity);
+    }
+    memcpy(out->data + out->size, data, size);
+    out->size += size;
+}
+
+
+static uint32_t read_u32le(const char* p) {
+    const uint8_t* b = (const uint8_t*)p;
+    return b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+
+// Over 64 KB of SVG, so blocks refer back across chunks and the window slides.
+static void test_svgz_single_member(void) {
+    wb2svg_img img = white_img(600, 400);
+    for (int y = 2; y < 398; y += 4) {
+        for (int x = 2 + y % 7; x < 580; x += 24) {
+            for (int i = 0; i < 12 + y % 5; ++i) img.pixels[y*img.width + x + i] = RED;
+        }
+    }
+    wb2svg_options options = wb2svg_default_options();
+    options.merge_runs = false;
+
+    int length = 0;
+    char* svg = wb2svg_wb2svg_alloc(img, &options, 0, &length);
+    CHECK(svg != NULL && length > 65536);
+
+    output out = {0};
+    CHECK(wb2svg_wb2svgz_to_func(write_to_output, &out, img, &options, 8) == 0);
+    CHECK(out.size > 18 && out.size < length/2);
+    CHECK((uint8_t)out.data[0] == 0x1F && (uint8_t)out.data[1] == 0x8B && out.data[2] == 8);
+    CHECK(read_u32le(out.data + out.size - 4) == (uint32_t)length);
+
+    int inflated_length = 0;
+    char* inflated = stbi_zlib_decode_noheader_malloc(out.data + 10, out.size - 18, &inflated_length);
+    CHECK(inflated != NULL && inflated_length == length);
+    CHECK(inflated && memcmp(inflated, svg, length) == 0);
+
+    free(inflated);
+    free(out.data);
+    wb2svg_free(svg);
+    wb2svg_img_free(&img);
+}
+
+
+static int count_occurrences(const char* text, int length, const char* needle) {
+    int count = 0, size = (int)strlen(needle);
+    for (int i = 0; i + size <= length; ++i) count += memcmp(text + i, needle, size) == 0;
+    return count;
+}
+
+
+// First needle in text[from..length), which may hold zero bytes; NULL if none.
+static const char* find(const char* text, int length, int from, const char* needle) {
+    int size = (int)strlen(needle);
+    for (int i = from; i + size <= length; ++i) {
+        if (memcmp(text + i, needle, size) == 0) return text + i;
+    }
+    return NULL;
+}
+
+
+// The PDF cross-reference table points at its objects, and the content
+// streams inflate to one stroked subpath per traced path.
+static void test_pdf_structure(void) {
+    wb2svg_img img = shapes_img();
+    wb2svg_options options = wb2svg_default_options();
+    options.curve_tolerance = 1.0f;
+    wb2svg_paths paths;
+    CHECK(wb2svg_trace(img, &options, &paths) == 0);
+
+    output out = {0};
+    CHECK(wb2svg_paths_to_pdf_func(write_to_output, &out, &paths) == 0);
+    const char* pdf = out.data;
+    CHECK(strncmp(pdf, "%PDF-1.4\n", 9) == 0);
+    CHECK(out.size > 6 && memcmp(pdf + out.size - 6, "%%EOF\n", 6) == 0);
+
+    const char* startxref = find(pdf, out.size, 0, "startxref\n");
+    CHECK(startxref != NULL);
+    if (startxref) {
+        int xref = atoi(startxref + 10);
+        CHECK(strncmp(pdf + xref, "xref\n0 ", 7) == 0);
+        int objects = atoi(pdf + xref + 7);
+        // Entries are 20 bytes, the first is the free list head.
+        const char* entry = strchr(pdf + xref + 7, '\n') + 1 + 20;
+        for (int object = 1; object < objects; ++object, entry += 20) {
+            char expected[32];
+            snprintf(expected, sizeof(expected), "%d 0 obj\n", object);
+            CHECK(strncmp(pdf + atoi(entry), expected, strlen(expected)) == 0);
+        }
+    }
+
+    int moves = 0, strokes = 0, curves = 0;
+    for (const char* s = pdf; (s = find(pdf, out.size, (int)(s - pdf), "/Length ")) != NULL;) {
+        int length = atoi(s + 8);
+        s = find(pdf, out.size, (int)(s - pdf), "stream\n") + 7;
+        int size = 0;
+        char* content = stbi_zlib_decode_malloc(s, length, &size);
+        CHECK(content != NULL);
+        if (content) {
+            moves += count_occurrences(content, size, " m ");
+            strokes += count_occurrences(content, size, "S\n");
+            curves += count_occurrences(content, size, " c ");
+        }
+        free(content);
+        s += length;
+    }
+    int cubic_segments = 0;
+    for (int i = 0; i < paths.count; ++i) {
+        if (paths.kinds[i] == WB2SVG_PATH_CUBIC) cubic_segments += (paths.offsets[i + 1] - paths.offsets[i] - 1)/3;
+    }
+    CHECK(moves == paths.count && strokes == paths.count);
+    CHECK(cubic_segments > 0 && curves == cubic_segments);
+
+    free(out.data);
+    wb2svg_paths_free(&paths);
+    wb2svg_img_free(&img);
+}
+
+
+// Short strokes of two colors scattered over the image, plus dots.
+static wb2svg_img scattered_img(void) {
+    wb2svg_img img = white_img(400, 300);
+    uint32_t seed = 12345;
+    for (int i = 0; i < 60; ++i) {
+        seed = seed*1103515245 + 12345;
+        int x = seed >> 8 & 0xFF, y = (seed >> 16 & 0xFF)*280/256 + 10;
+        wb2svg_rgba color = i % 3 ? RED : BLUE;
+        if (i % 10 == 0) {
+            for (int k = 0; k < 9; ++k) img.pixels[(y + k/3)*img.width + x + k % 3] = color;
+            continue;
+        }
+        for (int k = 0; k < 8 + i % 13; ++k) img.pixels[(y + (i & 1)*k/2)*img.width + x + k] = color;
+    }
+    return img;
+}
+
+
+static double pen_up_distance(const wb2svg_paths* paths) {
+    double distance = 0;
+    wb2svg_point pen = {0};
+    for (int i = 0; i < paths->count; ++i) {
+        wb2svg_point start = paths->points[paths->offsets[i]];
+        distance += hypot(start.x - pen.x, start.y - pen.y);
+        pen = paths->points[paths->offsets[i + 1] - 1];
+    }
+    return distance;
+}
+
+
+// Index of the unused path of original with the points of path i of ordered,
+// reversed if allowed, or -1.
+static int find_original(
+    const wb2svg_paths* original, const bool* used, const wb2svg_paths* ordered, int i, bool allow_reverse
+) {
+    const wb2svg_point* points = ordered->points + ordered->offsets[i];
+    int count = ordered->offsets[i + 1] - ordered->offsets[i];
+    for (int k = 0; k < original->count; ++k) {
+        if (used[k] || original->offsets[k + 1] - original->offsets[k] != count) continue;
+        const wb2svg_point* q = original->points + original->offsets[k];
+        bool forward = true, backward = allow_reverse;
+        for (int j = 0; j < count; ++j) {
+            forward = forward && points[j].x == q[j].x && points[j].y == q[j].y;
+            backward = backward && points[j].x == q[count - 1 - j].x && points[j].y == q[count - 1 - j].y;
+        }
+        wb2svg_rgba a = original->colors[k], b = ordered->colors[i];
+        if ((forward || backward) && a.r == b.r && a.g == b.g && a.b == b.b) return k;
+    }
+    return -1;
+}
+
+
+// Plotting order is a permutation of the paths, grouped by color, with less pen-up travel.
+static void test_plotting_order(void) {
+    wb2svg_img img = scattered_img();
+    wb2svg_options options = wb2svg_default_options();
+    options.min_component_size = 0;
+    wb2svg_paths original;
+    CHECK(wb2svg_trace(img, &options, &original) == 0);
+    CHECK(original.count > 40);
+
+    for (int allow_reverse = 0; allow_reverse <= 1; ++allow_reverse) {
+        wb2svg_paths ordered;
+        CHECK(wb2svg_trace(img, &options, &ordered) == 0);
+        CHECK(wb2svg_paths_order_for_plotting(&ordered, allow_reverse) == 0);
+        CHECK(ordered.count == original.count && ordered.point_count == original.point_count);
+
+        bool* used = calloc(original.count, sizeof(bool));
+        int color_changes = 0;
+        for (int i = 0; i < ordered.count; ++i) {
+            int k = find_original(&original, used, &ordered, i, allow_reverse);
+            CHECK(k >= 0);
+            if (k >= 0) used[k] = true;
+            color_changes += i > 0 && ordered.colors[i].b != ordered.colors[i - 1].b;
+        }
+        CHECK(color_changes == 1);
+        CHECK(pen_up_distance(&ordered) <= pen_up_distance(&original));
+        free(used);
+        wb2svg_paths_free(&ordered);
+    }
+
+    wb2svg_paths_free(&original);
+    wb2svg_img_free(&img);
+}
+
+
+// HPGL lifts the pen to each path's start and puts it down along the rest,
+// DXF has a polyline per path and a point per dot; both flip y.
+static void test_plotter_outputs(void) {
+    wb2svg_img img = scattered_img();
+    wb2svg_options options = wb2svg_default_options();
+    options.min_component_size = 0;
+    wb2svg_paths paths;
+    CHECK(wb2svg_trace(img, &options, &paths) == 0);
+    int dots = 0;
+    for (int i = 0; i < paths.count; ++i) dots += paths.offsets[i + 1] - paths.offsets[i] == 1;
+    CHECK(dots > 0);
+
+    output out = {0};
+    CHECK(wb2svg_paths_to_hpgl_func(write_to_output, &out, &paths) == 0);
+    write_to_output(&out, "", 1);
+    CHECK(strncmp(out.data, "IN;\n", 4) == 0);
+    const char* s = out.data;
+    for (int i = 0; i < paths.count; ++i) {
+        s = strstr(s, "PU");
+        CHECK(s != NULL);
+        if (s == NULL) break;
+        int x, y;
+        CHECK(sscanf(s, "PU%d,%d;", &x, &y) == 2);
+        wb2svg_point start = paths.points[paths.offsets[i]];
+        CHECK(x == start.x*WB2SVG_HPGL_UNITS_PER_PIXEL);
+        CHECK(y == (paths.height - start.y)*WB2SVG_HPGL_UNITS_PER_PIXEL);
+        s += 2;
+    }
+    CHECK(count_occurrences(out.data, out.size, "PU") == paths.count + 1);
+    CHECK(strstr(out.data, "SP1;") && strstr(out.data, "SP2;") && !strstr(out.data, "SP3;"));
+    CHECK(strcmp(out.data + out.size - 9, "PU;SP0;\n") == 0);
+
+    out.size = 0;
+    CHECK(wb2svg_paths_to_dxf_func(write_to_output, &out, &paths) == 0);
+    write_to_output(&out, "", 1);
+    CHECK(strncmp(out.data, "0\nSECTION\n2\nENTITIES\n", 20) == 0);
+    CHECK(strcmp(out.data + out.size - 16, "0\nENDSEC\n0\nEOF\n") == 0);
+    CHECK(count_occurrences(out.data, out.size, "\nPOLYLINE\n") == paths.count - dots);
+    CHECK(count_occurrences(out.data, out.size, "\nPOINT\n") == dots);
+    CHECK(count_occurrences(out.data, out.size, "\nVERTEX\n") == paths.point_count - dots);
+    // Group code and value lines, coordinates of vertices and points.
+    const char* entity = "";
+    int x = 0, point = 0;
+    for (char* line = out.data; *line;) {
+        char* value = strchr(line, '\n') + 1;
+        char* next = strchr(value, '\n') + 1;
+        next[-1] = '\0';
+        int code = atoi(line);
+        if (code == 0) entity = value;
+        bool vertex = strcmp(entity, "VERTEX") == 0 || strcmp(entity, "POINT") == 0;
+        if (vertex && code == 10) x = atoi(value);
+        if (vertex && code == 20 && point < paths.point_count) {
+            CHECK(x == paths.points[point].x && atoi(value) == paths.height - paths.points[point].y);
+            point++;
+        }
+        line = next;
+    }
+    CHECK(point == paths.point_count);
+
+    free(out.data);
+    wb2svg_paths_free(&paths);
+    wb2svg_img_free(&img);
+}
+
+
+// Traces img and its packed RGBA equivalent, plain and downscaled.
+static bool same_as_rgba(wb2svg_img img, wb2svg_img rgba) {
+    bool same = true;
+    for (int factor = 1; factor <= 2; ++factor) {
+        wb2svg_options options = wb2svg_default_options();
+        options.downscale = factor;
+        wb2svg_paths expected, paths;
+        CHECK(wb2svg_trace(rgba, &options, &expected) == 0);
+        CHECK(wb2svg_trace(img, &options, &paths) == 0);
+        same = same && same_paths(&expected, &paths);
+        wb2svg_paths_free(&paths);
+        wb2svg_paths_free(&expected);
+    }
+    return same;
+}
+
+
+// BT.601 video range, as documented for WB2SVG_FORMAT_NV12.
+static wb2svg_rgba yuv_to_rgba(int y, int u, int v) {
+    int c = 298*(y - 16) + 128, d = u - 128, e = v - 128;
+    int rgb[3] = { (c + 409*e) >> 8, (c - 100*d - 208*e) >> 8, (c + 516*d) >> 8 };
+    for (int i = 0; i < 3; ++i) rgb[i] = rgb[i] < 0 ? 0 : rgb[i] > 255 ? 255 : rgb[i];
+    return (wb2svg_rgba){ .r = (uint8_t)rgb[0], .g = (uint8_t)rgb[1], .b = (uint8_t)rgb[2], .a = 255 };
+}
+
+
+// Every input format, packed or with padded rows, traces like the same
+// pixels in packed RGBA.
+static void test_formats_match_rgba(void) {
+    wb2svg_img rgba = scattered_img();
+    for (int y = 20; y < 280; ++y) rgba.pixels[y*rgba.width + 300] = (wb2svg_rgba){ .a = 255 };
+    int width = rgba.width, height = rgba.height;
+    size_t count = (size_t)width*height;
+    int pad = 12;
+    uint8_t* bytes = malloc(count*4 + (size_t)height*pad + (size_t)(height/2)*(width + pad));
+
+    // RGBA and BGRA, packed and strided.
+    for (int stride = width*4; stride <= width*4 + pad; stride += pad) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                wb2svg_rgba c = rgba.pixels[y*width + x];
+                uint8_t* p = bytes + (size_t)y*stride + 4*x;
+                p[0] = c.r, p[1] = c.g, p[2] = c.b, p[3] = c.a;
+            }
+        }
+        wb2svg_img img = { .pixels = (wb2svg_rgba*)bytes, .width = width, .height = height, .stride = stride };
+        CHECK(same_as_rgba(img, rgba));
+        for (size_t y = 0; y < (size_t)height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                uint8_t* p = bytes + y*stride + 4*x;
+                uint8_t r = p[0];
+                p[0] = p[2], p[2] = r;
+            }
+        }
+        img.format = WB2SVG_FORMAT_BGRA;
+        CHECK(same_as_rgba(img, rgba));
+    }
+
+    // RGB, packed and strided.
+    for (int stride = width*3; stride <= width*3 + pad; stride += pad) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                wb2svg_rgba c = rgba.pixels[y*width + x];
+                uint8_t* p = bytes + (size_t)y*stride + 3*x;
+                p[0] = c.r, p[1] = c.g, p[2] = c.b;
+            }
+        }
+        wb2svg_img img = { .pixels = (wb2svg_rgba*)bytes, .width = width, .height = height, .stride = stride,
+                           .format = WB2SVG_FORMAT_RGB };
+        CHECK(same_as_rgba(img, rgba));
+    }
+
+    // GRAY: the RGBA equivalent is the gray levels in every channel.
+    wb2svg_img gray = wb2svg_img_alloc(width, height);
+    for (int stride = width; stride <= width + pad; stride += pad) {
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                wb2svg_rgba c = rgba.pixels[y*width + x];
+                uint8_t level = (uint8_t)((c.r + c.g + c.b)/3);
+                bytes[(size_t)y*stride + x] = level;
+                gray.pixels[y*width + x] = (wb2svg_rgba){ level, level, level, 255 };
+            }
+        }
+        wb2svg_img img = { .pixels = (wb2svg_rgba*)bytes, .width = width, .height = height, .stride = stride,
+                           .format = WB2SVG_FORMAT_GRAY };
+        CHECK(same_as_rgba(img, gray));
+    }
+
+    // NV12: luma per pixel, chroma per 2x2 block, red wherever a block has a
+    // colored pixel. Chroma follows the luma plane or has its own rows.
+    for (int stride = width; stride <= width + pad; stride += pad) {
+        uint8_t* uv = bytes + (size_t)height*stride;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                wb2svg_rgba c = rgba.pixels[y*width + x];
+                bytes[(size_t)y*stride + x] = c.r == 255 && c.g == 255 ? 235 : c.r == 0 && c.b == 0 ? 16 : 81;
+            }
+        }
+        for (int y = 0; y < height; y += 2) {
+            for (int x = 0; x < width; x += 2) {
+                bool colored = false;
+                for (int k = 0; k < 4; ++k) {
+                    wb2svg_rgba c = rgba.pixels[(y + k/2)*width + x + k % 2];
+                    colored = colored || c.r != c.b;
+                }
+                uv[(size_t)(y/2)*stride + x] = colored ? 90 : 128;
+                uv[(size_t)(y/2)*stride + x + 1] = colored ? 240 : 128;
+            }
+        }
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const uint8_t* chroma = uv + (size_t)(y/2)*stride + (x & ~1);
+                gray.pixels[y*width + x] = yuv_to_rgba(bytes[(size_t)y*stride + x], chroma[0], chroma[1]);
+            }
+        }
+        wb2svg_img img = { .pixels = (wb2svg_rgba*)bytes, .width = width, .height = height, .stride = stride,
+                           .format = WB2SVG_FORMAT_NV12 };
+        CHECK(same_as_rgba(img, gray));
+        uint8_t* chroma = malloc((size_t)(height/2)*stride);
+        memcpy(chroma, uv, (size_t)(height/2)*stride);
+        memset(uv, 0, (size_t)(height/2)*stride);
+        img.uv = chroma;
+        CHECK(same_as_rgba(img, gray));
+        free(chroma);
+    }
+
+    wb2svg_img_free(&gray);
+    free(bytes);
+    wb2svg_img_free(&rgba);
+}
+
+
+// A ctx reused for smaller, larger and in-place conversions gives the same
+// paths as wb2svg_trace, and keeps its buffers for images that fit them.
+static void test_ctx_reuse(void) {
+    wb2svg_img images[3] = { shapes_img(), scattered_img(), white_img(50, 40) };
+    for (int i = 0; i < 40; ++i) images[2].pixels[(i % 40)*50 + i] = BLUE;
+
+    wb2svg_ctx ctx;
+    wb2svg_ctx_init(&ctx);
+    for (int round = 0; round < 2; ++round) {
+        for (int k = 0; k < 3; ++k) {
+            wb2svg_paths expected, paths;
+            CHECK(wb2svg_trace(images[k], NULL, &expected) == 0);
+            CHECK(wb2svg_trace_ctx(&ctx, images[k], NULL, &paths) == 0);
+            CHECK(same_paths(&expected, &paths));
+            wb2svg_paths_free(&paths);
+
+            // In place overwrites the pixels, so it gets a copy.
+            wb2svg_img copy = wb2svg_img_alloc(images[k].width, images[k].height);
+            memcpy(copy.pixels, images[k].pixels, (size_t)copy.width*copy.height*sizeof(wb2svg_rgba));
+            wb2svg_options options = wb2svg_default_options();
+            options.in_place = true;
+            CHECK(wb2svg_trace_ctx(&ctx, copy, &options, &paths) == 0);
+            CHECK(same_paths(&expected, &paths));
+            wb2svg_paths_free(&paths);
+            wb2svg_img_free(&copy);
+            wb2svg_paths_free(&expected);
+        }
+    }
+    CHECK(ctx.capacity == 400*300);
+
+    int before = malloc_count;
+    int* labels = ctx.labels;
+    wb2svg_paths paths;
+    CHECK(wb2svg_trace_ctx(&ctx, images[2], NULL, &paths) == 0);
+    wb2svg_paths_free(&paths);
+    CHECK(ctx.labels == labels);
+    int with_ctx = malloc_count - before;
+    before = malloc_count;
+    CHECK(wb2svg_trace(images[2], NULL, &paths) == 0);
+    wb2svg_paths_free(&paths);
+    CHECK(with_ctx < malloc_count - before);
+
+    wb2svg_ctx_free(&ctx);
+    CHECK(ctx.labels == NULL && ctx.capacity == 0);
+    CHECK(wb2svg_trace_ctx(&ctx, images[2], NULL, &paths) == 0);
+    wb2svg_paths_free(&paths);
+    wb2svg_ctx_free(&ctx);
+    for (int k = 0; k < 3; ++k) wb2svg_img_free(&images[k]);
+}
+
+
+// In place the input pixels are the only image-sized buffer besides the
+// labels plane, so the peak is about half of the copying one.
+static void test_in_place_peak(void) {
+    size_t peaks[2];
+    for (int in_place = 0; in_place <= 1; ++in_place) {
+        wb2svg_img img = white_img(1200, 900);
+        for (int x = 100; x < 1100; ++x) img.pixels[450*img.width + x] = RED;
+        wb2svg_options options = wb2svg_default_options();
+        options.in_place = in_place;
+        wb2svg_memory_stats stats = {0};
+        wb2svg_memory_stats* previous = wb2svg_set_memory_stats(&stats);
+        wb2svg_paths paths;
+        CHECK(wb2svg_trace(img, &options, &paths) == 0);
+        wb2svg_paths_free(&paths);
+        wb2svg_set_memory_stats(previous);
+        peaks[in_place] = stats.peak;
+        CHECK(stats.peak >= wb2svg_scratch_size(img.width, img.height, &options));
+        wb2svg_memory_stats_free(&stats);
+        wb2svg_img_free(&img);
+    }
+    CHECK(peaks[1]*100 <= peaks[0]*51);
+}
+
+
+// Other formats are never converted in place, their scratch is the copying one.
+static void test_scratch_size_formats(void) {
+    wb2svg_img img = white_img(600, 400);
+    for (int x = 100; x < 500; ++x) img.pixels[200*img.width + x] = RED;
+    img.format = WB2SVG_FORMAT_BGRA;
+    wb2svg_options options = wb2svg_default_options();
+    options.in_place = true;
+    wb2svg_memory_stats stats = {0};
+    wb2svg_memory_stats* previous = wb2svg_set_memory_stats(&stats);
+    wb2svg_paths paths;
+    CHECK(wb2svg_trace(img, &options, &paths) == 0);
+    wb2svg_paths_free(&paths);
+    wb2svg_set_memory_stats(previous);
+    options.in_place = false;
+    CHECK(stats.peak >= wb2svg_scratch_size(img.width, img.height, &options));
+    wb2svg_memory_stats_free(&stats);
+    wb2svg_img_free(&img);
+}
+
+
+// Box filter with rounded averages, blocks at the right and bottom edges partial.
+static wb2svg_img box_filter(wb2svg_img img, int factor) {
+    wb2svg_img small = wb2svg_img_alloc((img.width + factor - 1)/factor, (img.height + factor - 1)/factor);
+    for (int y = 0; y < small.height; ++y) {
+        for (int x = 0; x < small.width; ++x) {
+            int sums[4] = {0}, count = 0;
+            for (int sy = y*factor; sy < (y + 1)*factor && sy < img.height; ++sy) {
+                for (int sx = x*factor; sx < (x + 1)*factor && sx < img.width; ++sx) {
+                    wb2svg_rgba c = img.pixels[sy*img.width + sx];
+                    sums[0] += c.r, sums[1] += c.g, sums[2] += c.b, sums[3] += c.a;
+                    count++;
+                }
+            }
+            small.pixels[y*small.width + x] = (wb2svg_rgba){
+                (uint8_t)((sums[0] + count/2)/count), (uint8_t)((sums[1] + count/2)/count),
+                (uint8_t)((sums[2] + count/2)/count), (uint8_t)((sums[3] + count/2)/count),
+            };
+        }
+    }
+    return small;
+}
+
+
+typedef struct {
+    wb2svg_img img;
+    int y;
+} row_reader;
+
+
+static int read_rows(void* context, wb2svg_rgba* rows, int count) {
+    row_reader* r = context;
+    memcpy(rows, r->img.pixels + (size_t)r->y*r->img.width, (size_t)count*r->img.width*sizeof(wb2svg_rgba));
+    r->y += count;
+    return 0;
+}
+
+
+// Strips give the paths of wb2svg_trace whatever their height, with lines,
+// junctions and loops crossing the strip boundaries.
+static void test_strips_match_trace(void) {
+    wb2svg_img images[2] = { shapes_img(), scattered_img() };
+    const int heights[] = { 1, 5, 16, 64, WB2SVG_STRIP_HEIGHT };
+    for (int k = 0; k < 2; ++k) {
+        for (int variant = 0; variant < 3; ++variant) {
+            wb2svg_options options = wb2svg_default_options();
+            if (variant == 1) options.curve_tolerance = 1.0f;
+            if (variant == 2) options.min_component_size = options.max_spur_length = 0;
+            wb2svg_paths expected;
+            CHECK(wb2svg_trace(images[k], &options, &expected) == 0);
+            for (int i = 0; i < (int)(sizeof(heights)/sizeof(heights[0])); ++i) {
+                row_reader reader = { .img = images[k] };
+                wb2svg_paths paths;
+                CHECK(wb2svg__trace_strips(
+                    read_rows, &reader, images[k].width, images[k].height, &options, heights[i], &paths
+                ) == 0);
+                CHECK(same_paths(&expected, &paths));
+                wb2svg_paths_free(&paths);
+            }
+            wb2svg_paths_free(&expected);
+        }
+    }
+    for (int k = 0; k < 2; ++k) wb2svg_img_free(&images[k]);
+}
+
+
+// A frame around the image stays open until the last row. Its chains are
+// all strips keep of it, far less than a copy of the image.
+static void test_strips_memory(void) {
+    wb2svg_img img = white_img(1000, 3000);
+    for (int i = 0; i < 3; ++i) {
+        for (int x = 10; x < img.width - 10; ++x) {
+            img.pixels[(10 + i)*img.width + x] = RED;
+            img.pixels[(img.height - 11 - i)*img.width + x] = RED;
+        }
+        for (int y = 10; y < img.height - 10; ++y) {
+            img.pixels[y*img.width + 10 + i] = RED;
+            img.pixels[y*img.width + img.width - 11 - i] = RED;
+        }
+    }
+    for (int y = 100; y < 2900; ++y) img.pixels[y*img.width + y/3] = BLUE;
+
+    wb2svg_paths expected;
+    CHECK(wb2svg_trace(img, NULL, &expected) == 0);
+    wb2svg_memory_stats stats = {0};
+    wb2svg_memory_stats* previous = wb2svg_set_memory_stats(&stats);
+    row_reader reader = { .img = img };
+    wb2svg_paths paths;
+    CHECK(wb2svg_trace_strips(read_rows, &reader, img.width, img.height, NULL, &paths) == 0);
+    wb2svg_set_memory_stats(previous);
+    CHECK(same_paths(&expected, &paths));
+    CHECK(stats.peak*4 < (size_t)img.width*img.height*sizeof(wb2svg_rgba));
+    wb2svg_memory_stats_free(&stats);
+    wb2svg_paths_free(&paths);
+    wb2svg_paths_free(&expected);
+    wb2svg_img_free(&img);
+}
+
+
+// options.downscale traces a box-filtered copy, in full frame and in strips.
+static void test_downscale_matches_box_filter(void) {
+    wb2svg_img img = shapes_img();
+    for (int factor = 2; factor <= 3; ++factor) {
+        wb2svg_img small = box_filter(img, factor);
+        wb2svg_paths expected, paths;
+        CHECK(wb2svg_trace(small, NULL, &expected) == 0);
+        wb2svg_options options = wb2svg_default_options();
+        options.downscale = factor;
+        CHECK(wb2svg_trace(img, &options, &paths) == 0);
+        CHECK(same_paths(&expected, &paths));
+        wb2svg_paths_free(&paths);
+        row_reader reader = { .img = img };
+        CHECK(wb2svg_trace_strips(read_rows, &reader, img.width, img.height, &options, &paths) == 0);
+        CHECK(same_paths(&expected, &paths));
+        wb2svg_paths_free(&paths);
+        wb2svg_paths_free(&expected);
+        wb2svg_img_free(&small);
+    }
+    wb2svg_img_free(&img);
+}
+
+
+// Scaled JPEG decoding gives images of the rounded up size, close to a box
+// filtered full size decode.
+static void test_jpeg_scaled_decode(void) {
+    // Odd sizes leave partial blocks, the background is a gradient.
+    wb2svg_img strokes = scattered_img();
+    wb2svg_img img = wb2svg_img_alloc(397, 299);
+    for (int y = 0; y < img.height; ++y) {
+        for (int x = 0; x < img.width; ++x) {
+            wb2svg_rgba c = strokes.pixels[y*strokes.width + x];
+            if (c.g == 255) c = (wb2svg_rgba){ (uint8_t)(128 + x/4), (uint8_t)(200 - y/3), 220, 255 };
+            img.pixels[y*img.width + x] = c;
+        }
+    }
+    wb2svg_img_free(&strokes);
+    output jpeg = {0};
+    CHECK(stbi_write_jpg_to_func(write_to_output, &jpeg, img.width, img.height, 4, img.pixels, 95));
+    int width, height;
+    wb2svg_img full = { .pixels = (wb2svg_rgba*)stbi_load_from_memory(
+        (const stbi_uc*)jpeg.data, jpeg.size, &width, &height, NULL, 4
+    ), .width = width, .height = height };
+    CHECK(full.pixels != NULL && width == 397 && height == 299);
+
+    for (int denom = 2; denom <= 8; denom *= 2) {
+        stbi_set_jpeg_scale_on_load(denom);
+        wb2svg_rgba* pixels = (wb2svg_rgba*)stbi_load_from_memory(
+            (const stbi_uc*)jpeg.data, jpeg.size, &width, &height, NULL, 4
+        );
+        stbi_set_jpeg_scale_on_load(1);
+        CHECK(pixels != NULL && width == (397 + denom - 1)/denom && height == (299 + denom - 1)/denom);
+        if (pixels == NULL || full.pixels == NULL) continue;
+
+        wb2svg_img box = box_filter(full, denom);
+        double squared = 0;
+        for (int i = 0; i < box.width*box.height; ++i) {
+            int d[3] = { pixels[i].r - box.pixels[i].r, pixels[i].g - box.pixels[i].g, pixels[i].b - box.pixels[i].b };
+            squared += d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+        }
+        double mse = squared/(3.0*box.width*box.height);
+        CHECK(10*log10(255.0*255.0/mse) > 30);
+        wb2svg_img_free(&box);
+        stbi_image_free(pixels);
+    }
+    stbi_image_free(full.pixels);
+    free(jpeg.data);
+    wb2svg_img_free(&img);
+}
+
+
+int main(void) {
+    test_graph_skips_speckles();
+    test_dot_keeps_color();
+    test_arena_takes_all();
+    test_path_data_round_trip();
+    test_bin_round_trip();
+    test_svgz_single_member();
+    test_pdf_structure();
+    test_plotting_order();
+    test_plotter_outputs();
+    test_formats_match_rgba();
+    test_ctx_reuse();
+    test_in_place_peak();
+    test_scratch_size_formats();
+    test_strips_match_trace();
+    test_strips_memory();
+    test_downscale_matches_box_filter();
+    test_jpeg_scaled_decode();
+
+    if (failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -18,6 +18,75 @@ Usage:
     } else {
         printf("%s", svg);
     }
+
+Or stream output of any size, e.g. to a file:
+
+    static void write_to_file(void* context, void* data, int size) {
+        fwrite(data, 1, size, (FILE*)context);
+    }
+
+    wb2svg_wb2svg_to_func(write_to_file, file, img, NULL);
+
+Or with WB2SVG_SVGZ defined, stream .svgz:
+
+    wb2svg_wb2svgz_to_func(write_to_file, file, img, NULL, 8);
+
+Or trace once and serialize the paths as often as needed:
+
+    wb2svg_paths paths;
+    if (wb2svg_trace(img, NULL, &paths) == 0) {
+        wb2svg_paths_to_svg_func(write_to_file, file, &paths, NULL);
+        wb2svg_paths_free(&paths);
+    }
+
+With WB2SVG_PDF defined, wb2svg_paths_to_pdf_func writes the paths as PDF
+using stb_image_write.h's zlib compressor (or your own, see
+WB2SVG_ZLIB_COMPRESS).
+
+Define WB2SVG_MALLOC, WB2SVG_REALLOC and WB2SVG_FREE before the implementation
+to use your own allocator, or carve everything from one block:
+
+    wb2svg_arena arena;
+    wb2svg_arena_init(&arena, block, block_size);
+    wb2svg_arena* previous = wb2svg_set_arena(&arena);
+    int length = wb2svg_wb2svg(img, svg, MAX_SVG_SIZE); // -1 if block_size is exceeded too
+    wb2svg_set_arena(previous);
+
+To convert many images, keep scratch memory between calls:
+
+    wb2svg_ctx ctx = {0};
+    for (...) {
+        if (wb2svg_trace_ctx(&ctx, img, NULL, &paths) == 0) { ... }
+    }
+    wb2svg_ctx_free(&ctx);
+
+Images too large for memory are read row by row and traced in strips:
+
+    static int read_rows(void* context, wb2svg_rgba* rows, int count) {
+        return fread(rows, sizeof(wb2svg_rgba)*width, count, (FILE*)context) == (size_t)count ? 0 : -1;
+    }
+
+    wb2svg_wb2svg_strips_to_func(write_to_file, file, read_rows, raw_file, width, height, NULL);
+
+stb_image.h's stbi_jpeg_rows_read decodes JPEGs that way without an RGBA copy,
+see example.c.
+
+Input files can be mapped instead of read, to decode them in place:
+
+    wb2svg_file file;
+    if (wb2svg_file_open(&file, file_path) == 0) {
+        pixels = stbi_load_from_memory(file.data, file.size, &width, &height, NULL, 4);
+        wb2svg_file_close(&file);
+    }
+
+Or let wb2svg allocate the output:
+
+    int length;
+    char* svg = wb2svg_wb2svg_alloc(img, NULL, 0, &length);
+    if (svg != NULL) {
+        fwrite(svg, 1, length, stdout);
+        wb2svg_free(svg);
+    }
 */
 
 #ifndef WB2SVG_H
@@ -25,10 +94,14 @@ Usage:
 
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
 #include <math.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #ifdef WB2SVG_DEBUG
 #undef STB_IMAGE_WRITE_IMPLEMENTATION
@@ -40,17 +113,384 @@ typedef struct {
 } wb2svg_rgba;
 
 
+typedef enum {
+    WB2SVG_FORMAT_RGBA, // 4 bytes per pixel, the default
+    WB2SVG_FORMAT_BGRA, // 4 bytes per pixel
+    WB2SVG_FORMAT_RGB,  // 3 bytes per pixel
+    WB2SVG_FORMAT_GRAY, // 1 byte per pixel
+    WB2SVG_FORMAT_NV12, // Y plane, then a half resolution plane of interleaved U, V (BT.601 video range)
+} wb2svg_pixel_format;
+
+
+// Input images may use any format and stride, zero-initialized fields mean
+// packed RGBA. Images wb2svg creates are always packed RGBA.
 typedef struct {
-    wb2svg_rgba *pixels;
+    wb2svg_rgba *pixels; // First row, in format
     int width;
     int height;
+    int stride;          // Bytes per row, 0 for packed rows
+    wb2svg_pixel_format format;
+    const uint8_t* uv;   // NV12 chroma rows with the same stride, NULL if they follow the Y plane
 } wb2svg_img;
 
 
+// Returns an image with NULL pixels on allocation failure. Release it with
+// wb2svg_img_free, the pixels come from wb2svg's allocator.
 wb2svg_img wb2svg_img_alloc(int width, int height);
+void wb2svg_img_free(wb2svg_img* img);
+
+
+typedef struct {
+    int x0, y0; // Top-left corner (inclusive)
+    int x1, y1; // Bottom-right corner (inclusive)
+} wb2svg_bbox;
+
 
+typedef struct {
+    int pixel_count;
+    wb2svg_bbox bbox;
+    wb2svg_rgba color; // Most frequent color among component pixels
+} wb2svg_component;
+
+
+typedef struct {
+    int* labels; // width*height, 0 for white pixels, i+1 for pixels of items[i]
+    int width;
+    int height;
+    wb2svg_component* items;
+    int count;
+    int capacity;
+} wb2svg_components;
+
+
+// Labels 8-connected non-white regions of the (thinned) image.
+// Components are ordered by their first pixel in raster order.
+// Returns 0 on success, -1 on allocation failure.
+int wb2svg_label_components(wb2svg_img img, wb2svg_components* components);
+void wb2svg_components_free(wb2svg_components* components);
+
+
+typedef struct {
+    int x, y;
+} wb2svg_point;
+
+
+typedef struct {
+    int x, y;             // First pixel of the node in raster order
+    int pixel_count;
+    int component;        // Component label, see wb2svg_components.labels
+    int degree;           // Number of incident edge ends (a self-loop counts twice)
+    int adjacency_offset; // Incident edges are adjacency[adjacency_offset..+degree]
+} wb2svg_node;
+
+
+typedef struct {
+    int from, to;      // Node indices, equal for closed loops
+    int offset;        // Pixel chain is points[offset..+count], from a pixel of
+    int count;         // node `from` to a pixel of node `to`
+    int component;
+    wb2svg_rgba color; // Most frequent color along the chain
+} wb2svg_edge;
+
+
+// Skeleton as a graph. Nodes are endpoints and junctions: 8-connected
+// clusters of pixels that do not have exactly two skeleton neighbors, plus
+// one anchor pixel per closed loop. Edges are the pixel chains between them.
+typedef struct {
+    wb2svg_node* nodes;
+    int node_count;
+    wb2svg_edge* edges;
+    int edge_count;
+    wb2svg_point* points;
+    int point_count;
+    int* adjacency; // Edge indices, grouped by node
+} wb2svg_graph;
+
+
+// Components with fewer than min_component_size pixels are skipped without
+// reading their pixels, 0 keeps all. Returns 0 on success, -1 on allocation failure.
+int wb2svg_graph_build(wb2svg_img img, const wb2svg_components* components, int min_component_size, wb2svg_graph* graph);
+void wb2svg_graph_free(wb2svg_graph* graph);
+
+
+typedef enum {
+    WB2SVG_SVG_PATH_PER_CHAIN,  // A <path> element with its own stroke per traced chain
+    WB2SVG_SVG_PATH_PER_COLOR,  // A single <path> per color, chains are its subpaths
+    WB2SVG_SVG_GROUP_PER_COLOR, // Chains as <path> elements inside a <g> per color
+} wb2svg_svg_grouping;
 
+
+typedef struct {
+    int min_component_size; // Components with fewer pixels are dropped as speckles
+    int max_spur_length;    // Dangling branches up to this many pixels are pruned at junctions
+    float simplify_tolerance; // Max deviation in pixels of simplified paths, 0 disables simplification
+    float curve_tolerance;    // Max deviation in pixels of fitted cubic Beziers, 0 emits polylines
+    bool merge_runs;          // Emit one segment per chain-code direction change instead of per pixel
+    // Grouping by color draws colors one after another instead of in tracing order.
+    wb2svg_svg_grouping svg_grouping;
+    bool in_place; // Use packed RGBA input pixels as scratch (they are overwritten) instead of a copy
+    // Trace a downscale x downscale box-filtered copy, 1 for full resolution.
+    // Sizes, tolerances and output coordinates are in its pixels.
+    int downscale;
+} wb2svg_options;
+
+
+wb2svg_options wb2svg_default_options(void);
+
+
+// Writes zero-terminated SVG into buffer, returns its length or -1 when it
+// does not fit (or on allocation failure).
 int wb2svg_wb2svg(wb2svg_img img, char* buffer, int buffer_size);
+// Same as wb2svg_wb2svg, options may be NULL for defaults.
+int wb2svg_wb2svg_ex(wb2svg_img img, const wb2svg_options* options, char* buffer, int buffer_size);
+
+
+// Receives SVG output in chunks of up to WB2SVG_WRITE_BUFFER_SIZE bytes,
+// same as stbi_write_func.
+typedef void wb2svg_write_func(void* context, void* data, int size);
+
+
+#ifndef WB2SVG_WRITE_BUFFER_SIZE
+#define WB2SVG_WRITE_BUFFER_SIZE 4096
+#endif
+// Path commands and tags are written whole into the staging buffer.
+#if WB2SVG_WRITE_BUFFER_SIZE < 256
+#error "WB2SVG_WRITE_BUFFER_SIZE must be at least 256"
+#endif
+
+
+// Streams SVG to func as it is generated, so output size is unbounded.
+// Returns 0 on success, -1 on allocation failure. options may be NULL.
+int wb2svg_wb2svg_to_func(wb2svg_write_func* func, void* context, wb2svg_img img, const wb2svg_options* options);
+
+#ifdef WB2SVG_SVGZ
+// Streams gzip compressed SVG (.svgz) to func as a single gzip member, since
+// many readers (browsers among them) stop after the first one. The SVG is
+// deflated as it is generated, with a built-in compressor holding about
+// 330 KB. level trades speed for size: it is the number of earlier matches
+// tried per position, min 1. Returns 0 on success, -1 on allocation failure.
+int wb2svg_wb2svgz_to_func(wb2svg_write_func* func, void* context, wb2svg_img img, const wb2svg_options* options, int level);
+#endif // WB2SVG_SVGZ
+
+// Converts into a buffer that grows as needed. Returns the zero-terminated
+// SVG (free with wb2svg_free) and stores its length in *length (may be NULL),
+// or returns NULL on allocation failure. capacity_hint is the initial
+// buffer size, 0 for an estimate from the skeleton size.
+char* wb2svg_wb2svg_alloc(wb2svg_img img, const wb2svg_options* options, int capacity_hint, int* length);
+
+
+typedef enum {
+    WB2SVG_PATH_LINES, // Polyline through all points
+    WB2SVG_PATH_CUBIC, // Start point, then two controls and an end point per segment
+} wb2svg_path_kind;
+
+
+// Traced paths as a structure of arrays in a single allocation, so they
+// can be serialized to several formats after tracing once. Path i has
+// points[offsets[i]..offsets[i + 1]]. Whichever function fills them,
+// release them with wb2svg_paths_free.
+typedef struct {
+    int width, height; // Of the traced image
+    int count;
+    int point_count;
+    wb2svg_point* points;
+    int* offsets;      // count + 1 entries
+    wb2svg_rgba* colors;
+    wb2svg_bbox* bboxes;
+    uint8_t* kinds;    // wb2svg_path_kind
+} wb2svg_paths;
+
+
+// Runs the whole pipeline up to vector paths, options may be NULL.
+// Returns 0 on success, -1 on allocation failure.
+int wb2svg_trace(wb2svg_img img, const wb2svg_options* options, wb2svg_paths* paths);
+void wb2svg_paths_free(wb2svg_paths* paths);
+
+
+// Per-pixel scratch buffers kept between wb2svg_trace_ctx calls, so that
+// converting a stream of images allocates only when a larger one arrives.
+// Zero-initialize or use wb2svg_ctx_init. Not for concurrent use.
+typedef struct {
+    wb2svg_rgba* processed; // Blurred, quantized and thinned image, unused in place
+    wb2svg_rgba* rows;      // 5 source rows of the blur, then 2 rows of thinning marks; first an input row and box sums when downscaling
+    int* labels;            // wb2svg_components labels, then graph node ids
+    size_t capacity;           // In pixels, for labels
+    size_t processed_capacity; // In pixels
+    int row_capacity;          // In pixels per row
+} wb2svg_ctx;
+
+void wb2svg_ctx_init(wb2svg_ctx* ctx);
+// Releases the buffers. ctx stays usable, so this also drops the memory
+// held for an unusually large image.
+void wb2svg_ctx_free(wb2svg_ctx* ctx);
+// Same as wb2svg_trace, with scratch memory from ctx.
+int wb2svg_trace_ctx(wb2svg_ctx* ctx, wb2svg_img img, const wb2svg_options* options, wb2svg_paths* paths);
+
+
+// While an arena is set, all memory wb2svg allocates on the calling thread
+// is carved from its block, the wb2svg_memory_stats table included; running
+// out of it fails like any allocation
+// (-1). Only the most recent allocation is ever given back, so reuse the
+// block by calling wb2svg_arena_init again, e.g. per request. Results from
+// the arena (wb2svg_paths, wb2svg_ctx buffers) must not be freed after it
+// is unset. Without an arena, wb2svg uses WB2SVG_MALLOC, WB2SVG_REALLOC and
+// WB2SVG_FREE, which default to the C library.
+typedef struct {
+    unsigned char* base;
+    size_t size;
+    size_t used;
+    size_t peak; // Highest used so far
+} wb2svg_arena;
+
+void wb2svg_arena_init(wb2svg_arena* arena, void* memory, size_t size);
+// NULL unsets the arena. Returns the previous one.
+wb2svg_arena* wb2svg_set_arena(wb2svg_arena* arena);
+
+// wb2svg's own allocator: the arena while one is set, WB2SVG_MALLOC,
+// WB2SVG_REALLOC and WB2SVG_FREE otherwise, counted by wb2svg_memory_stats.
+// Define stb_image_write.h's STBIW_MALLOC, STBIW_REALLOC and STBIW_FREE as
+// these to have its zlib compressor (WB2SVG_PDF) use it too.
+void* wb2svg_malloc(size_t size);
+void* wb2svg_realloc(void* pointer, size_t size);
+void wb2svg_free(void* pointer);
+
+
+// Bytes of the per-pixel and per-row buffers a conversion of a width x
+// height image allocates (processed or downscaled image unless in_place,
+// row rings, component labels turned graph node ids), options may be NULL.
+// The size assumes packed RGBA input: conversions of other formats or
+// padded strides ignore in_place, so query them with in_place false.
+// Components, graph and paths come on top; they grow with the traced
+// skeleton, not the image: about 20 KB plus 0.5-3% on the sample photos.
+// Measure with wb2svg_memory_stats.
+size_t wb2svg_scratch_size(int width, int height, const wb2svg_options* options);
+
+// While set, counts the bytes wb2svg allocates on the calling thread,
+// including output it allocates. Zero-initialize, and release the table of
+// live allocations with wb2svg_memory_stats_free. While an arena is set the
+// table is carved from it like everything else (uncounted), and comes back
+// with the arena rather than with wb2svg_memory_stats_free.
+typedef struct {
+    size_t current; // Held now
+    size_t peak;    // Most held at once
+    void** pointers; // Live allocations and their sizes, by address
+    size_t* sizes;
+    int capacity;
+    int count;
+    bool in_arena;   // Table carved from an arena
+} wb2svg_memory_stats;
+
+// NULL unsets the stats. Returns the previous ones.
+wb2svg_memory_stats* wb2svg_set_memory_stats(wb2svg_memory_stats* stats);
+void wb2svg_memory_stats_free(wb2svg_memory_stats* stats);
+
+// SVG serializers, same results as wb2svg_wb2svg_ex and wb2svg_wb2svg_to_func.
+// Only svg_grouping of options is used, options may be NULL.
+int wb2svg_paths_to_svg(const wb2svg_paths* paths, const wb2svg_options* options, char* buffer, int buffer_size);
+int wb2svg_paths_to_svg_func(
+    wb2svg_write_func* func, void* context, const wb2svg_paths* paths, const wb2svg_options* options
+);
+
+
+#ifndef WB2SVG_STRIP_HEIGHT
+#define WB2SVG_STRIP_HEIGHT 128
+#endif
+
+// Strip mode input: fills rows with the next count rows of the image, top
+// to bottom. Returns 0 on success, -1 to abort the conversion.
+typedef int wb2svg_read_func(void* context, wb2svg_rgba* rows, int count);
+
+// Strip mode for images too large to hold: every row is read once and
+// preprocessed WB2SVG_STRIP_HEIGHT rows at a time, with the overlap the blur
+// and thinning need. The skeleton graph is built as rows arrive, chains
+// crossing a strip boundary are carried as their pixels and open ends, and
+// a component is traced as soon as the rows have passed it. Memory is
+// O(width*WB2SVG_STRIP_HEIGHT) plus the chains of components still open.
+// Results are the same as wb2svg_trace and wb2svg_wb2svg_to_func on the
+// whole image (in_place is ignored). Returns 0 on success, -1 on allocation
+// or read failure.
+int wb2svg_trace_strips(
+    wb2svg_read_func* read, void* read_context, int width, int height,
+    const wb2svg_options* options, wb2svg_paths* paths
+);
+// With WB2SVG_SVG_PATH_PER_CHAIN the paths of a component are written as
+// soon as it is traced, so components come in the order they end rather
+// than start. Grouping by color has to collect all paths first.
+int wb2svg_wb2svg_strips_to_func(
+    wb2svg_write_func* func, void* context, wb2svg_read_func* read, void* read_context,
+    int width, int height, const wb2svg_options* options
+);
+
+
+// Binary paths format, version 1. Varints are unsigned LEB128 (7 bits per
+// byte, low bits first, high bit set on all but the last byte):
+//   "WB2B", version byte
+//   varint width, height, path count, total point count
+//   varint palette size, then r, g, b bytes per color
+//   per path:
+//     varint tag: palette index*2, plus 1 for WB2SVG_PATH_CUBIC
+//     varint point count
+//     per point zigzag varints dx, dy from the previous point; the first
+//     point continues from the previous path's last point, or from 0, 0
+// Zigzag maps 0, -1, 1, -2, ... to 0, 1, 2, 3, ...
+#define WB2SVG_BIN_VERSION 1
+
+// Same conventions as wb2svg_paths_to_svg (without the zero terminator).
+int wb2svg_paths_to_bin(const wb2svg_paths* paths, char* buffer, int buffer_size);
+int wb2svg_paths_to_bin_func(wb2svg_write_func* func, void* context, const wb2svg_paths* paths);
+// Fills paths (release with wb2svg_paths_free), returns 0 on success, -1 on
+// malformed data or allocation failure.
+int wb2svg_bin_decode(const void* data, int size, wb2svg_paths* paths);
+
+
+// Reorders paths to cut pen-up travel for plotters: grouped by color, then
+// each next path is the one starting nearest to where the previous one
+// ended (greedy nearest neighbor over a grid of path endpoints). With
+// allow_reverse paths may be drawn from their end. Returns 0 on success,
+// -1 on allocation failure (paths are left unchanged).
+int wb2svg_paths_order_for_plotting(wb2svg_paths* paths, bool allow_reverse);
+
+#ifndef WB2SVG_HPGL_UNITS_PER_PIXEL
+#define WB2SVG_HPGL_UNITS_PER_PIXEL 10 // Plotter units are 0.025 mm
+#endif
+
+// Plotter and CAD outputs with y pointing up. Curves are flattened to
+// lines, colors map to pens (HPGL, in order of appearance) or to the
+// nearest of the red, green, blue and black/white AutoCAD colors (DXF R12).
+// Returns 0 on success, -1 on allocation failure.
+int wb2svg_paths_to_hpgl_func(wb2svg_write_func* func, void* context, const wb2svg_paths* paths);
+int wb2svg_paths_to_dxf_func(wb2svg_write_func* func, void* context, const wb2svg_paths* paths);
+
+
+#ifdef WB2SVG_PDF
+#ifndef WB2SVG_PDF_CHUNK_SIZE
+#define WB2SVG_PDF_CHUNK_SIZE (1024 * 1024)
+#endif
+
+// Streams a single page PDF with the paths stroked in image coordinates
+// (1 unit per pixel). Drawing operators are deflate compressed into one
+// content stream per WB2SVG_PDF_CHUNK_SIZE bytes, using stb_image_write.h's
+// zlib compressor or WB2SVG_ZLIB_COMPRESS. Returns 0 on success, -1 on
+// allocation failure.
+int wb2svg_paths_to_pdf_func(wb2svg_write_func* func, void* context, const wb2svg_paths* paths);
+#endif // WB2SVG_PDF
+
+
+// Read-only contents of a whole file. On POSIX systems the file is mapped,
+// with sequential read-ahead advice where the feature-test macros declare
+// posix_madvise, so decoding from data reads the page cache directly.
+// Elsewhere, with WB2SVG_NO_MMAP defined or if mapping fails, it is read
+// into an allocated buffer.
+typedef struct {
+    const uint8_t* data;
+    int size;
+    bool mapped;
+} wb2svg_file;
+
+// Returns 0 on success, -1 if the file can't be opened or read, or is
+// larger than INT_MAX bytes. On failure file is zeroed.
+int wb2svg_file_open(wb2svg_file* file, const char* file_path);
+void wb2svg_file_close(wb2svg_file* file);
 
 #endif // WB2SVG_H
 
@@ -59,6 +499,286 @@ int wb2svg_wb2svg(wb2svg_img img, char* buffer, int buffer_size);
 
 #define WB2SVG__RETURN(res) do { result = res; goto defer; } while(0)
 
+#if defined(WB2SVG_MALLOC) && defined(WB2SVG_FREE) && defined(WB2SVG_REALLOC)
+// ok
+#elif !defined(WB2SVG_MALLOC) && !defined(WB2SVG_FREE) && !defined(WB2SVG_REALLOC)
+// ok
+#else
+#error "Must define all or none of WB2SVG_MALLOC, WB2SVG_FREE, and WB2SVG_REALLOC."
+#endif
+
+#ifndef WB2SVG_MALLOC
+#define WB2SVG_MALLOC(size)           malloc(size)
+#define WB2SVG_REALLOC(pointer, size) realloc(pointer, size)
+#define WB2SVG_FREE(pointer)          free(pointer)
+#endif
+
+#ifndef WB2SVG_NO_THREAD_LOCALS
+    #if defined(__cplusplus) && __cplusplus >= 201103L
+        #define WB2SVG_THREAD_LOCAL thread_local
+    #elif defined(__GNUC__) && __GNUC__ < 5
+        #define WB2SVG_THREAD_LOCAL __thread
+    #elif defined(_MSC_VER)
+        #define WB2SVG_THREAD_LOCAL __declspec(thread)
+    #elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+        #define WB2SVG_THREAD_LOCAL _Thread_local
+    #endif
+
+    #ifndef WB2SVG_THREAD_LOCAL
+        #if defined(__GNUC__)
+            #define WB2SVG_THREAD_LOCAL __thread
+        #endif
+    #endif
+#endif
+
+#ifndef WB2SVG_THREAD_LOCAL
+#define WB2SVG_THREAD_LOCAL // One arena for all threads
+#endif
+
+
+// Arena blocks are preceded by their size, padded to keep the alignment.
+#define WB2SVG__ARENA_ALIGN 16
+#define WB2SVG__ARENA_ALIGN_UP(size) (((size) + WB2SVG__ARENA_ALIGN - 1) & ~(size_t)(WB2SVG__ARENA_ALIGN - 1))
+
+static WB2SVG_THREAD_LOCAL wb2svg_arena* wb2svg__arena;
+
+
+void wb2svg_arena_init(wb2svg_arena* arena, void* memory, size_t size) {
+    uintptr_t start = WB2SVG__ARENA_ALIGN_UP((uintptr_t)memory);
+    size_t skip = start - (uintptr_t)memory;
+    arena->base = (unsigned char*)start;
+    arena->size = size > skip ? (size - skip) & ~(size_t)(WB2SVG__ARENA_ALIGN - 1) : 0;
+    arena->used = 0;
+    arena->peak = 0;
+}
+
+
+wb2svg_arena* wb2svg_set_arena(wb2svg_arena* arena) {
+    wb2svg_arena* previous = wb2svg__arena;
+    wb2svg__arena = arena;
+    return previous;
+}
+
+
+static bool wb2svg__arena_owns(const wb2svg_arena* arena, const void* pointer) {
+    const unsigned char* p = pointer;
+    return arena != NULL && p >= arena->base && p < arena->base + arena->size;
+}
+
+
+static size_t* wb2svg__arena_header(void* pointer) {
+    return (size_t*)((unsigned char*)pointer - WB2SVG__ARENA_ALIGN);
+}
+
+
+static bool wb2svg__arena_is_last(const wb2svg_arena* arena, void* pointer) {
+    return (unsigned char*)pointer + WB2SVG__ARENA_ALIGN_UP(*wb2svg__arena_header(pointer)) == arena->base + arena->used;
+}
+
+
+// Moves the end of the arena to offset plus size bytes, if they fit.
+static bool wb2svg__arena_extend(wb2svg_arena* arena, size_t offset, size_t size) {
+    if (size > arena->size - offset) return false;
+    size_t end = offset + WB2SVG__ARENA_ALIGN_UP(size);
+    if (end > arena->size) return false;
+    arena->used = end;
+    if (end > arena->peak) arena->peak = end;
+    return true;
+}
+
+
+static void* wb2svg__arena_alloc(wb2svg_arena* arena, size_t size) {
+    size_t offset = arena->used + WB2SVG__ARENA_ALIGN;
+    if (offset > arena->size || !wb2svg__arena_extend(arena, offset, size)) return NULL;
+    void* pointer = arena->base + offset;
+    *wb2svg__arena_header(pointer) = size;
+    return pointer;
+}
+
+
+static WB2SVG_THREAD_LOCAL wb2svg_memory_stats* wb2svg__stats;
+
+
+wb2svg_memory_stats* wb2svg_set_memory_stats(wb2svg_memory_stats* stats) {
+    wb2svg_memory_stats* previous = wb2svg__stats;
+    wb2svg__stats = stats;
+    return previous;
+}
+
+
+void wb2svg_memory_stats_free(wb2svg_memory_stats* stats) {
+    if (!stats->in_arena) {
+        WB2SVG_FREE(stats->pointers);
+        WB2SVG_FREE(stats->sizes);
+    }
+    memset(stats, 0, sizeof(*stats));
+}
+
+
+static size_t wb2svg__stats_home(const wb2svg_memory_stats* stats, const void* pointer) {
+    return (size_t)(((uint64_t)(uintptr_t)pointer * 0x9E3779B97F4A7C15ull) >> 32) & (stats->capacity - 1);
+}
+
+
+// Linear probing, returns the entry of pointer or the empty one ending its probe.
+static size_t wb2svg__stats_find(const wb2svg_memory_stats* stats, const void* pointer) {
+    size_t i = wb2svg__stats_home(stats, pointer);
+    while (stats->pointers[i] != NULL && stats->pointers[i] != pointer) i = (i + 1) & (stats->capacity - 1);
+    return i;
+}
+
+
+// The table itself is not counted, it comes from the arena while one is set
+// and straight from WB2SVG_MALLOC otherwise. A replaced arena table is never
+// the last block, so it stays until the arena is reused.
+static bool wb2svg__stats_grow(wb2svg_memory_stats* stats) {
+    int capacity = stats->capacity ? stats->capacity*2 : 256;
+    wb2svg_arena* arena = wb2svg__arena;
+    wb2svg_memory_stats grown = *stats;
+    grown.capacity = capacity;
+    grown.in_arena = arena != NULL;
+    if (arena) {
+        size_t used = arena->used;
+        grown.pointers = wb2svg__arena_alloc(arena, capacity*sizeof(void*));
+        grown.sizes = wb2svg__arena_alloc(arena, capacity*sizeof(size_t));
+        if (grown.pointers == NULL || grown.sizes == NULL) {
+            arena->used = used;
+            return false;
+        }
+    } else {
+        grown.pointers = WB2SVG_MALLOC(capacity*sizeof(void*));
+        grown.sizes = WB2SVG_MALLOC(capacity*sizeof(size_t));
+        if (grown.pointers == NULL || grown.sizes == NULL) {
+            if (grown.pointers) WB2SVG_FREE(grown.pointers);
+            if (grown.sizes) WB2SVG_FREE(grown.sizes);
+            return false;
+        }
+    }
+    memset(grown.pointers, 0, capacity*sizeof(void*));
+    for (int i = 0; i < stats->capacity; ++i) {
+        if (stats->pointers[i] == NULL) continue;
+        size_t j = wb2svg__stats_find(&grown, stats->pointers[i]);
+        grown.pointers[j] = stats->pointers[i];
+        grown.sizes[j] = stats->sizes[i];
+    }
+    if (!stats->in_arena) {
+        if (stats->pointers) WB2SVG_FREE(stats->pointers);
+        if (stats->sizes) WB2SVG_FREE(stats->sizes);
+    }
+    *stats = grown;
+    return true;
+}
+
+
+static void wb2svg__stats_add(wb2svg_memory_stats* stats, void* pointer, size_t size) {
+    stats->current += size;
+    if (stats->current > stats->peak) stats->peak = stats->current;
+    // Without an entry the bytes are never subtracted, the peak errs high.
+    if (stats->count*2 >= stats->capacity && !wb2svg__stats_grow(stats)) return;
+    size_t i = wb2svg__stats_find(stats, pointer);
+    stats->pointers[i] = pointer;
+    stats->sizes[i] = size;
+    stats->count++;
+}
+
+
+// Pointers allocated before stats were set are ignored.
+static void wb2svg__stats_remove(wb2svg_memory_stats* stats, void* pointer) {
+    if (stats->capacity == 0) return;
+    size_t mask = stats->capacity - 1;
+    size_t i = wb2svg__stats_find(stats, pointer);
+    if (stats->pointers[i] == NULL) return;
+    stats->current -= stats->sizes[i];
+    stats->count--;
+
+    // Backward shift deletion: later entries of the probe move into the gap
+    // unless their home lies cyclically within (gap, entry].
+    for (size_t j = (i + 1) & mask; stats->pointers[j] != NULL; j = (j + 1) & mask) {
+        size_t home = wb2svg__stats_home(stats, stats->pointers[j]);
+        bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (stays) continue;
+        stats->pointers[i] = stats->pointers[j];
+        stats->sizes[i] = stats->sizes[j];
+        i = j;
+    }
+    stats->pointers[i] = NULL;
+}
+
+
+static void* wb2svg__malloc(size_t size) {
+    void* pointer = wb2svg__arena ? wb2svg__arena_alloc(wb2svg__arena, size) : WB2SVG_MALLOC(size);
+    if (pointer && wb2svg__stats) wb2svg__stats_add(wb2svg__stats, pointer, size);
+    return pointer;
+}
+
+
+static void* wb2svg__calloc(size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) return NULL;
+    void* pointer = wb2svg__malloc(count * size);
+    if (pointer) memset(pointer, 0, count * size);
+    return pointer;
+}
+
+
+static void* wb2svg__realloc_untracked(void* pointer, size_t size) {
+    wb2svg_arena* arena = wb2svg__arena;
+    if (!wb2svg__arena_owns(arena, pointer)) return WB2SVG_REALLOC(pointer, size);
+
+    // The last block grows in place, others are copied.
+    size_t old_size = *wb2svg__arena_header(pointer);
+    if (size <= old_size) return pointer;
+    if (wb2svg__arena_is_last(arena, pointer)) {
+        if (!wb2svg__arena_extend(arena, (unsigned char*)pointer - arena->base, size)) return NULL;
+        *wb2svg__arena_header(pointer) = size;
+        return pointer;
+    }
+    void* grown = wb2svg__arena_alloc(arena, size);
+    if (grown) memcpy(grown, pointer, old_size < size ? old_size : size);
+    return grown;
+}
+
+
+static void* wb2svg__realloc(void* pointer, size_t size) {
+    if (pointer == NULL) return wb2svg__malloc(size);
+    void* grown = wb2svg__realloc_untracked(pointer, size);
+    if (grown && wb2svg__stats) {
+        wb2svg__stats_remove(wb2svg__stats, pointer);
+        wb2svg__stats_add(wb2svg__stats, grown, size);
+    }
+    return grown;
+}
+
+
+// Arena memory is only reclaimed for the most recent allocation.
+static void wb2svg__free(void* pointer) {
+    if (pointer == NULL) return;
+    if (wb2svg__stats) wb2svg__stats_remove(wb2svg__stats, pointer);
+    wb2svg_arena* arena = wb2svg__arena;
+    if (!wb2svg__arena_owns(arena, pointer)) {
+        WB2SVG_FREE(pointer);
+        return;
+    }
+    if (wb2svg__arena_is_last(arena, pointer)) {
+        arena->used = (unsigned char*)pointer - WB2SVG__ARENA_ALIGN - arena->base;
+    }
+}
+
+
+void* wb2svg_malloc(size_t size) {
+    return wb2svg__malloc(size);
+}
+
+
+void* wb2svg_realloc(void* pointer, size_t size) {
+    return wb2svg__realloc(pointer, size);
+}
+
+
+void wb2svg_free(void* pointer) {
+    wb2svg__free(pointer);
+}
+
+
 #define WB2SVG__IMG_AT(img, row, col) (img).pixels[(row)*(img).width + (col)]
 #define WB2SVG__IMG_WITHIN(img, row, col) \
     (0 <= (col) && (col) < (img).width && 0 <= (row) && (row) < (img).height)
@@ -66,14 +786,21 @@ int wb2svg_wb2svg(wb2svg_img img, char* buffer, int buffer_size);
 
 wb2svg_img wb2svg_img_alloc(int width, int height) {
     wb2svg_img img = {0};
-    img.pixels = malloc(sizeof(wb2svg_rgba)*width*height);
-    assert(img.pixels != NULL);
+    if (width <= 0 || height <= 0 || (size_t)width > SIZE_MAX / sizeof(wb2svg_rgba) / height) return img;
+    img.pixels = wb2svg__malloc(sizeof(wb2svg_rgba)*width*height);
+    if (img.pixels == NULL) return img;
     img.width = width;
     img.height = height;
     return img;
 }
 
 
+void wb2svg_img_free(wb2svg_img* img) {
+    wb2svg__free(img->pixels);
+    memset(img, 0, sizeof(*img));
+}
+
+
 typedef struct {
     float h; // Hue        (0.0-360.0 degrees)
     float s; // Saturation (0.0-1.0)
@@ -157,7 +884,12 @@ static void wb2svg__quantize(wb2svg_img img) {
 }
 
 
-static wb2svg_rgba wb2svg__gauss_filter_at(wb2svg_img img, int cx, int cy) {
+// Source rows the blur keeps: 2 above, the current one and 2 below.
+#define WB2SVG__BLUR_ROWS 5
+
+
+// rows are the source rows cy - 2 to cy + 2, NULL outside of the image.
+static wb2svg_rgba wb2svg__gauss_filter_at(const wb2svg_rgba* rows[5], int width, int cx) {
     static float g[5][5] = {
         {2.0,  4.0,  5.0,  4.0,  2.0},
         {4.0,  9.0,  12.0, 9.0,  4.0},
@@ -170,10 +902,10 @@ static wb2svg_rgba wb2svg__gauss_filter_at(wb2svg_img img, int cx, int cy) {
     float sx_g = 0.0;
     float sx_b = 0.0;
     for (int dy = -2; dy <= 2; ++dy) {
+        const wb2svg_rgba* row = rows[dy + 2];
         for (int dx = -2; dx <= 2; ++dx) {
             int x = cx + dx;
-            int y = cy + dy;
-            wb2svg_rgba c = WB2SVG__IMG_WITHIN(img, y, x) ? WB2SVG__IMG_AT(img, y, x) : WB2SVG__BLACK;
+            wb2svg_rgba c = row != NULL && 0 <= x && x < width ? row[x] : WB2SVG__BLACK;
             sx_r += c.r*g[dy + 2][dx + 2];
             sx_g += c.g*g[dy + 2][dx + 2];
             sx_b += c.b*g[dy + 2][dx + 2];
@@ -188,12 +920,94 @@ static wb2svg_rgba wb2svg__gauss_filter_at(wb2svg_img img, int cx, int cy) {
 }
 
 
-static void wb2svg__gauss_filter(wb2svg_img img, wb2svg_img blur) {
+static uint8_t wb2svg__clamp_byte(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+
+// Row y of an input image as RGBA: the row itself for RGBA, otherwise
+// converted into out.
+static const wb2svg_rgba* wb2svg__input_row(wb2svg_img img, int y, wb2svg_rgba* out) {
+    static const int pixel_sizes[] = { 4, 4, 3, 1, 1 };
+    size_t stride = img.stride ? (size_t)img.stride : (size_t)img.width*pixel_sizes[img.format];
+    const uint8_t* row = (const uint8_t*)img.pixels + y*stride;
+
+    switch (img.format) {
+    case WB2SVG_FORMAT_RGBA:
+        return (const wb2svg_rgba*)row;
+    case WB2SVG_FORMAT_BGRA:
+        for (int x = 0; x < img.width; ++x) {
+            out[x] = (wb2svg_rgba){ .r = row[4*x + 2], .g = row[4*x + 1], .b = row[4*x], .a = row[4*x + 3] };
+        }
+        break;
+    case WB2SVG_FORMAT_RGB:
+        for (int x = 0; x < img.width; ++x) {
+            out[x] = (wb2svg_rgba){ .r = row[3*x], .g = row[3*x + 1], .b = row[3*x + 2], .a = 255 };
+        }
+        break;
+    case WB2SVG_FORMAT_GRAY:
+        for (int x = 0; x < img.width; ++x) {
+            out[x] = (wb2svg_rgba){ .r = row[x], .g = row[x], .b = row[x], .a = 255 };
+        }
+        break;
+    case WB2SVG_FORMAT_NV12: {
+        const uint8_t* uv = img.uv ? img.uv : (const uint8_t*)img.pixels + img.height*stride;
+        uv += (y/2)*stride;
+        for (int x = 0; x < img.width; ++x) {
+            int c = 298*(row[x] - 16) + 128;
+            int d = uv[x & ~1] - 128;
+            int e = uv[x | 1] - 128;
+            out[x] = (wb2svg_rgba){
+                .r = wb2svg__clamp_byte((c + 409*e) >> 8),
+                .g = wb2svg__clamp_byte((c - 100*d - 208*e) >> 8),
+                .b = wb2svg__clamp_byte((c + 516*d) >> 8),
+                .a = 255,
+            };
+        }
+        break;
+    }
+    }
+    return out;
+}
+
+
+// Rows of other formats are converted once into ring, WB2SVG__BLUR_ROWS rows.
+static void wb2svg__gauss_filter(wb2svg_img img, wb2svg_img blur, wb2svg_rgba* ring) {
     assert(img.width == blur.width);
     assert(img.height == blur.height);
+    const wb2svg_rgba* source[WB2SVG__BLUR_ROWS];
+    int next = 0; // First row not read yet
+    for (int cy = 0; cy < img.height; ++cy) {
+        for (; next <= cy + 2 && next < img.height; ++next) {
+            int slot = next % WB2SVG__BLUR_ROWS;
+            source[slot] = wb2svg__input_row(img, next, &ring[slot*img.width]);
+        }
+        const wb2svg_rgba* rows[5];
+        for (int dy = -2; dy <= 2; ++dy) {
+            int y = cy + dy;
+            rows[dy + 2] = 0 <= y && y < img.height ? source[y % WB2SVG__BLUR_ROWS] : NULL;
+        }
+        for (int cx = 0; cx < img.width; ++cx) {
+            WB2SVG__IMG_AT(blur, cy, cx) = wb2svg__gauss_filter_at(rows, img.width, cx);
+        }
+    }
+}
+
+
+// Packed RGBA only. Rows above the current one are already overwritten,
+// their source is kept in ring, 3 rows of scratch.
+static void wb2svg__gauss_filter_in_place(wb2svg_img img, wb2svg_rgba* ring) {
     for (int cy = 0; cy < img.height; ++cy) {
+        memcpy(&ring[(cy % 3)*img.width], &WB2SVG__IMG_AT(img, cy, 0), img.width*sizeof(wb2svg_rgba));
+        const wb2svg_rgba* rows[5];
+        for (int dy = -2; dy <= 2; ++dy) {
+            int y = cy + dy;
+            if (y < 0 || y >= img.height) rows[dy + 2] = NULL;
+            else if (dy <= 0) rows[dy + 2] = &ring[(y % 3)*img.width];
+            else rows[dy + 2] = &WB2SVG__IMG_AT(img, y, 0);
+        }
         for (int cx = 0; cx < img.width; ++cx) {
-            WB2SVG__IMG_AT(blur, cy, cx) = wb2svg__gauss_filter_at(img, cx, cy);
+            WB2SVG__IMG_AT(img, cy, cx) = wb2svg__gauss_filter_at(rows, img.width, cx);
         }
     }
 }
@@ -203,10 +1017,20 @@ static void wb2svg__gauss_filter(wb2svg_img img, wb2svg_img blur) {
 #define MARKER_AT(marker, y, x)
 
 
+static void wb2svg__apply_marks(wb2svg_img img, const bool* marks, int y) {
+    for (int x = 0; x < img.width; x++) {
+        if (marks[x]) WB2SVG__IMG_AT(img, y, x) = WB2SVG__WHITE;
+    }
+}
+
+
+// marker is a ring of 2 rows: marks of a row are applied once the next row
+// is marked, when no later row reads it anymore.
 static void wb2svg__guo_hall_thinning_iteration(wb2svg_img img, bool* marker, int iter) {
-    memset(marker, false, sizeof(bool) * img.width * img.height);
-    for (int y = 1; y < img.height; y++) {
-        for (int x = 1; x < img.width; x++) {
+    for (int y = 1; y < img.height - 1; y++) {
+        bool* marks = &marker[(y & 1)*img.width];
+        memset(marks, false, sizeof(bool) * img.width);
+        for (int x = 1; x < img.width - 1; x++) {
             bool p2 = !WB2SVG__IS_WHITE(WB2SVG__IMG_AT(img, y-1, x));
             bool p3 = !WB2SVG__IS_WHITE(WB2SVG__IMG_AT(img, y-1, x+1));
             bool p4 = !WB2SVG__IS_WHITE(WB2SVG__IMG_AT(img, y, x+1));
@@ -224,144 +1048,3782 @@ static void wb2svg__guo_hall_thinning_iteration(wb2svg_img img, bool* marker, in
             int m = iter == 0 ? ((p6 | p7 | !p9) & p8) : ((p2 | p3 | !p5) & p4);
 
             if (C == 1 && (N >= 2 && N <= 3) & (m == 0)) {
-                marker[y*img.width + x] = true;
-            }
-        }
-    }
-
-    for (int y = 0; y < img.height; y++) {
-        for (int x = 0; x < img.width; x++) {
-            if (marker[y*img.width + x]) {
-                WB2SVG__IMG_AT(img, y, x) = WB2SVG__WHITE;
+                marks[x] = true;
             }
         }
+        if (y > 1) wb2svg__apply_marks(img, &marker[((y - 1) & 1)*img.width], y - 1);
     }
+    if (img.height > 2) wb2svg__apply_marks(img, &marker[((img.height - 2) & 1)*img.width], img.height - 2);
 }
 
 
-static void wb2svg__guo_hall_thinning(wb2svg_img img) {
-    bool* marker = calloc(img.width * img.height, sizeof(bool));
+// marker is 2*width scratch.
+static void wb2svg__guo_hall_thinning(wb2svg_img img, bool* marker) {
     for (int i = 0; i < 3; ++i) {
         wb2svg__guo_hall_thinning_iteration(img, marker, 0);
         wb2svg__guo_hall_thinning_iteration(img, marker, 1);
     };
-    free(marker);
 }
 
 
-static void wb2svg__preprocess(wb2svg_img img, wb2svg_img processed) {
-    assert(img.width == processed.width);
-    assert(img.height == processed.height);
-
-    wb2svg__gauss_filter(img, processed);
-    wb2svg__quantize(processed);
-    wb2svg__guo_hall_thinning(processed);
-    #ifdef WB2SVG_DEBUG
-        if (!stbi_write_png("thin.png", processed.width, processed.height, 4, processed.pixels, processed.width * sizeof(uint32_t))) {
-            fprintf(stderr, "ERROR: could not save file out/thin.png\n");
-        }
-    #endif // WB2SVG_DEBUG
+static int wb2svg__downscaled(int size, int factor) {
+    return (size + factor - 1)/factor;
 }
 
 
-static void wb2svg__appendf(char* buffer, int buffer_size, int* cursor, const char* format, ...) {
-    int remaining = buffer_size - *cursor;
-    if (remaining <= 0) {
-        *cursor = -1;
-        return;
+// Adds a row of width pixels to the r, g, b, a sums of its factor wide blocks.
+static void wb2svg__downscale_add(const wb2svg_rgba* row, int width, int factor, uint32_t* sums) {
+    for (int x = 0; x < width; ++x) {
+        uint32_t* sum = &sums[4*(x/factor)];
+        sum[0] += row[x].r;
+        sum[1] += row[x].g;
+        sum[2] += row[x].b;
+        sum[3] += row[x].a;
     }
+}
 
-    va_list args;
-    va_start(args, format);
-    int written = vsnprintf(buffer + *cursor, remaining, format, args);
-    va_end(args);
 
-    if (written < 0 || written >= remaining) {
-        *cursor = -1;
+// Stores the rounded block averages of rows summed rows and clears the sums.
+static void wb2svg__downscale_store(uint32_t* sums, int width, int factor, int rows, wb2svg_rgba* out) {
+    for (int x = 0; x < wb2svg__downscaled(width, factor); ++x) {
+        uint32_t* sum = &sums[4*x];
+        uint32_t columns = width - x*factor < factor ? width - x*factor : factor;
+        uint32_t count = columns*rows;
+        out[x] = (wb2svg_rgba){
+            .r = (uint8_t)((sum[0] + count/2)/count),
+            .g = (uint8_t)((sum[1] + count/2)/count),
+            .b = (uint8_t)((sum[2] + count/2)/count),
+            .a = (uint8_t)((sum[3] + count/2)/count),
+        };
+        sum[0] = sum[1] = sum[2] = sum[3] = 0;
+    }
+}
+
+
+// Box filters img into small, blocks at the right and bottom edges may be
+// partial. rows is a row of img plus 4 sums per pixel of small, at most
+// wb2svg__row_scratch_size(img.width) for factors of 2 and up.
+static void wb2svg__downscale(wb2svg_img img, wb2svg_img small, int factor, wb2svg_rgba* rows) {
+    uint32_t* sums = (uint32_t*)&rows[img.width];
+    memset(sums, 0, (size_t)small.width*4*sizeof(uint32_t));
+    for (int y = 0; y < img.height; y += factor) {
+        int count = img.height - y < factor ? img.height - y : factor;
+        for (int i = 0; i < count; ++i) {
+            wb2svg__downscale_add(wb2svg__input_row(img, y + i, rows), img.width, factor, sums);
+        }
+        wb2svg__downscale_store(sums, img.width, factor, count, &WB2SVG__IMG_AT(small, y/factor, 0));
+    }
+}
+
+
+// Works in place if processed is img (packed RGBA). rows is scratch as in wb2svg_ctx.
+static void wb2svg__preprocess(wb2svg_img img, wb2svg_img processed, wb2svg_rgba* rows) {
+    assert(img.width == processed.width);
+    assert(img.height == processed.height);
+
+    if (processed.pixels == img.pixels) {
+        wb2svg__gauss_filter_in_place(processed, rows);
     } else {
-        *cursor += written;
+        wb2svg__gauss_filter(img, processed, rows);
+    }
+    wb2svg__quantize(processed);
+    wb2svg__guo_hall_thinning(processed, (bool*)&rows[WB2SVG__BLUR_ROWS*img.width]);
+    #ifdef WB2SVG_DEBUG
+        if (!stbi_write_png("thin.png", processed.width, processed.height, 4, processed.pixels, processed.width * sizeof(uint32_t))) {
+            fprintf(stderr, "ERROR: could not save file out/thin.png\n");
+        }
+    #endif // WB2SVG_DEBUG
+}
+
+
+static int wb2svg__uf_find(int* parent, int label) {
+    while (parent[label] != label) {
+        parent[label] = parent[parent[label]];
+        label = parent[label];
     }
+    return label;
 }
 
 
-int wb2svg_wb2svg(wb2svg_img img, char* buffer, int buffer_size) {
+static int wb2svg__uf_union(int* parent, int a, int b) {
+    a = wb2svg__uf_find(parent, a);
+    b = wb2svg__uf_find(parent, b);
+    // Smaller label wins, so the root is always the earliest provisional label.
+    if (a < b) {
+        parent[b] = a;
+        return a;
+    }
+    parent[a] = b;
+    return b;
+}
+
+
+static int wb2svg__palette_index(wb2svg_rgba c) {
+    if (c.r == 0 && c.g == 0 && c.b == 0) return 0;
+    if (c.r == 255 && c.g == 0 && c.b == 0) return 1;
+    if (c.r == 0 && c.g == 255 && c.b == 0) return 2;
+    if (c.r == 0 && c.g == 0 && c.b == 255) return 3;
+    return -1;
+}
+
+
+#define WB2SVG__PALETTE_SIZE 4
+
+
+static const wb2svg_rgba wb2svg__palette[WB2SVG__PALETTE_SIZE] = {
+    { .r = 0,   .g = 0,   .b = 0,   .a = 255 },
+    { .r = 255, .g = 0,   .b = 0,   .a = 255 },
+    { .r = 0,   .g = 255, .b = 0,   .a = 255 },
+    { .r = 0,   .g = 0,   .b = 255, .a = 255 },
+};
+
+
+// labels is width*height caller owned memory, every entry is written.
+static int wb2svg__label_components(wb2svg_img img, int* labels, wb2svg_components* components) {
     int result = 0;
-    int cursor = 0;
+    int* parent = NULL;
+    int (*color_counts)[WB2SVG__PALETTE_SIZE] = NULL;
 
-    if (!buffer || buffer_size <= 0) return -1;
+    memset(components, 0, sizeof(*components));
+    components->width = img.width;
+    components->height = img.height;
+    components->labels = labels;
 
-    wb2svg_img processed = wb2svg_img_alloc(img.width, img.height);
-    wb2svg__preprocess(img, processed);
+    // First pass: provisional labels, equivalences recorded in union-find forest.
+    // Label 0 is background, so parent[0] is never used.
+    int parent_capacity = 256;
+    int parent_count = 1;
+    parent = wb2svg__malloc(parent_capacity * sizeof(int));
+    if (parent == NULL) WB2SVG__RETURN(-1);
+    parent[0] = 0;
 
-    wb2svg__appendf(
-        buffer, buffer_size, &cursor,
-        "<svg width=\"%d\" height=\"%d\" xmlns=\"http://www.w3.org/2000/svg\">",
-        processed.width, processed.height
-    );
-    if (cursor < 0) WB2SVG__RETURN(cursor);
-
-    bool path_emitted = false;
-    int passed_y = 0;
-    do {
-        path_emitted = false;
-        for (int cy = passed_y; cy < processed.height; ++cy) {
-            for (int cx = 0; cx < processed.width; ++cx) {
-                if (!WB2SVG__IS_WHITE(WB2SVG__IMG_AT(processed, cy, cx))) {
-                    wb2svg_rgba color = WB2SVG__IMG_AT(processed, cy, cx);
-                    wb2svg__appendf(
-                        buffer, buffer_size, &cursor,
-                        "<path fill=\"none\" stroke=\"rgb(%d, %d, %d)\" d=\"M %d %d ",
-                        color.r, color.g, color.b, cx, cy
-                    );
-                    if (cursor < 0) WB2SVG__RETURN(cursor);
-
-                    while (!WB2SVG__IS_WHITE(WB2SVG__IMG_AT(processed, cy, cx))) {
-                        WB2SVG__IMG_AT(processed, cy, cx) = WB2SVG__WHITE;
-                        for (int dy = -1; dy < 2; ++dy) {
-                            for (int dx = -1; dx < 2; ++dx) {
-                                if (dy == 0 && dx == 0) continue;
-
-                                int ny = cy + dy;
-                                int nx = cx + dx;
-                                if (!WB2SVG__IMG_WITHIN(processed, ny, nx)) continue;
-
-                                if (!WB2SVG__IS_WHITE(WB2SVG__IMG_AT(processed, ny, nx))) {
-                                    wb2svg__appendf(
-                                        buffer, buffer_size, &cursor,
-                                        "L %d %d ", nx, ny
-                                    );
-                                    if (cursor < 0) WB2SVG__RETURN(cursor);
-
-                                    cy = ny;
-                                    cx = nx;
-                                    goto next;
-                                }
-                            }
-                        }
-                        next: continue;
-                    }
+    for (int y = 0; y < img.height; ++y) {
+        for (int x = 0; x < img.width; ++x) {
+            if (WB2SVG__IS_WHITE(WB2SVG__IMG_AT(img, y, x))) {
+                labels[y*img.width + x] = 0;
+                continue;
+            }
 
-                    wb2svg__appendf(
-                        buffer, buffer_size, &cursor,
-                        "\" />"
-                    );
-                    if (cursor < 0) WB2SVG__RETURN(cursor);
+            // Already visited 8-neighbors: W, NW, N, NE.
+            int label = 0;
+            if (x > 0 && labels[y*img.width + x - 1]) {
+                label = labels[y*img.width + x - 1];
+            }
+            if (y > 0) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int nx = x + dx;
+                    if (nx < 0 || nx >= img.width) continue;
+                    int neighbor = labels[(y - 1)*img.width + nx];
+                    if (!neighbor) continue;
+                    label = label ? wb2svg__uf_union(parent, label, neighbor) : neighbor;
+                }
+            }
 
-                    path_emitted = true;
-                    break;
+            if (!label) {
+                if (parent_count == parent_capacity) {
+                    parent_capacity *= 2;
+                    int* grown = wb2svg__realloc(parent, parent_capacity * sizeof(int));
+                    if (grown == NULL) WB2SVG__RETURN(-1);
+                    parent = grown;
                 }
+                label = parent_count++;
+                parent[label] = label;
+            }
+            labels[y*img.width + x] = label;
+        }
+    }
+
+    // Roots are numbered in increasing provisional order, which is the raster
+    // order of each component's first pixel. parent[] is reused to map labels.
+    int count = 0;
+    for (int label = 1; label < parent_count; ++label) {
+        if (parent[label] == label) {
+            parent[label] = -(++count);
+        } else {
+            // Parent is always smaller, so it is already resolved to a final label.
+            parent[label] = parent[parent[label]];
+        }
+    }
+
+    components->items = wb2svg__calloc(count > 0 ? count : 1, sizeof(wb2svg_component));
+    color_counts = wb2svg__calloc(count > 0 ? count : 1, sizeof(*color_counts));
+    if (components->items == NULL || color_counts == NULL) WB2SVG__RETURN(-1);
+    components->count = count;
+    components->capacity = count;
+
+    // Second pass: final labels, pixel counts, bounding boxes and color histograms.
+    for (int y = 0; y < img.height; ++y) {
+        for (int x = 0; x < img.width; ++x) {
+            int* label = &labels[y*img.width + x];
+            if (!*label) continue;
+            *label = -parent[*label];
+
+            wb2svg_component* c = &components->items[*label - 1];
+            if (c->pixel_count == 0) {
+                c->bbox = (wb2svg_bbox){ .x0 = x, .y0 = y, .x1 = x, .y1 = y };
+                c->color = WB2SVG__IMG_AT(img, y, x);
+            } else {
+                if (x < c->bbox.x0) c->bbox.x0 = x;
+                if (x > c->bbox.x1) c->bbox.x1 = x;
+                c->bbox.y1 = y;
             }
-            passed_y++;
+            c->pixel_count++;
+
+            int color = wb2svg__palette_index(WB2SVG__IMG_AT(img, y, x));
+            if (color >= 0) color_counts[*label - 1][color]++;
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        int best = 0;
+        for (int color = 1; color < WB2SVG__PALETTE_SIZE; ++color) {
+            if (color_counts[i][color] > color_counts[i][best]) best = color;
+        }
+        // Components without palette colors keep the color of their first pixel.
+        if (color_counts[i][best] > 0) components->items[i].color = wb2svg__palette[best];
+    }
+
+defer:
+    wb2svg__free(parent);
+    wb2svg__free(color_counts);
+    if (result < 0) {
+        wb2svg__free(components->items);
+        memset(components, 0, sizeof(*components));
+    }
+    return result;
+}
+
+
+int wb2svg_label_components(wb2svg_img img, wb2svg_components* components) {
+    int* labels = wb2svg__malloc((size_t)img.width * img.height * sizeof(int));
+    if (labels == NULL) {
+        memset(components, 0, sizeof(*components));
+        return -1;
+    }
+    if (wb2svg__label_components(img, labels, components) < 0) {
+        wb2svg__free(labels);
+        return -1;
+    }
+    return 0;
+}
+
+
+void wb2svg_components_free(wb2svg_components* components) {
+    wb2svg__free(components->labels);
+    wb2svg__free(components->items);
+    memset(components, 0, sizeof(*components));
+}
+
+
+static bool wb2svg__grow(void** items, int* capacity, size_t item_size) {
+    int new_capacity = *capacity ? *capacity*2 : 256;
+    void* grown = wb2svg__realloc(*items, new_capacity*item_size);
+    if (grown == NULL) return false;
+    *items = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+
+// Grows a dynamic array to hold at least needed items, evaluates to false on allocation failure.
+#define WB2SVG__RESERVE(items, capacity, needed) \
+    ((needed) <= (capacity) || wb2svg__reserve((void**)&(items), &(capacity), (needed), sizeof(*(items))))
+
+
+static bool wb2svg__reserve(void** items, int* capacity, int needed, size_t item_size) {
+    int new_capacity = *capacity ? *capacity : 256;
+    while (new_capacity < needed) new_capacity = new_capacity > INT_MAX/2 ? INT_MAX : new_capacity*2;
+    void* grown = wb2svg__realloc(*items, new_capacity*item_size);
+    if (grown == NULL) return false;
+    *items = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+
+// Appends item to a dynamic array, evaluates to false on allocation failure.
+#define WB2SVG__APPEND(items, count, capacity, item) \
+    (((count) < (capacity) || wb2svg__grow((void**)&(items), &(capacity), sizeof(*(items)))) \
+        && ((items)[(count)++] = (item), true))
+
+
+// 8-direction chain code: 0 is east, counting clockwise in image coordinates.
+static const int wb2svg__dir_dx[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+static const int wb2svg__dir_dy[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+
+// Chain code of a unit step, -1 for anything else.
+static int wb2svg__chain_code(int dx, int dy) {
+    static const int codes[9] = { 5, 6, 7, 4, -1, 0, 3, 2, 1 };
+    if (dx < -1 || dx > 1 || dy < -1 || dy > 1) return -1;
+    return codes[(dy + 1)*3 + dx + 1];
+}
+
+
+static bool wb2svg__skeleton_at(wb2svg_img img, int x, int y) {
+    return WB2SVG__IMG_WITHIN(img, y, x) && !WB2SVG__IS_WHITE(WB2SVG__IMG_AT(img, y, x));
+}
+
+
+static int wb2svg__skeleton_degree(wb2svg_img img, int x, int y) {
+    int degree = 0;
+    for (int dir = 0; dir < 8; ++dir) {
+        degree += wb2svg__skeleton_at(img, x + wb2svg__dir_dx[dir], y + wb2svg__dir_dy[dir]);
+    }
+    return degree;
+}
+
+
+// Graph building overwrites the component labels: pixels it has not visited
+// keep their label, node pixels get -(node index + 1) and walked chain
+// pixels WB2SVG__WALKED. White pixels stay 0.
+#define WB2SVG__WALKED INT_MIN
+
+
+typedef struct {
+    wb2svg_graph* graph;
+    int* labels; // Component labels turning into node ids, see WB2SVG__WALKED
+    wb2svg_point* stack;
+    int stack_count;
+    int stack_capacity;
+    int node_capacity;
+    int edge_capacity;
+    int point_capacity;
+} wb2svg__graph_builder;
+
+
+// Adds a node for the cluster of non-chain pixels around (x, y).
+static bool wb2svg__graph_add_node(wb2svg__graph_builder* b, wb2svg_img img, int component, int x, int y) {
+    wb2svg_node node = { .x = x, .y = y, .component = component };
+    if (!WB2SVG__APPEND(b->graph->nodes, b->graph->node_count, b->node_capacity, node)) return false;
+    int id = b->graph->node_count;
+
+    b->stack_count = 0;
+    wb2svg_point p = { x, y };
+    if (!WB2SVG__APPEND(b->stack, b->stack_count, b->stack_capacity, p)) return false;
+    b->labels[y*img.width + x] = -id;
+    while (b->stack_count > 0) {
+        p = b->stack[--b->stack_count];
+        b->graph->nodes[id - 1].pixel_count++;
+        for (int dir = 0; dir < 8; ++dir) {
+            int nx = p.x + wb2svg__dir_dx[dir];
+            int ny = p.y + wb2svg__dir_dy[dir];
+            if (!wb2svg__skeleton_at(img, nx, ny) || b->labels[ny*img.width + nx] <= 0) continue;
+            if (wb2svg__skeleton_degree(img, nx, ny) == 2) continue;
+
+            b->labels[ny*img.width + nx] = -id;
+            wb2svg_point n = { nx, ny };
+            if (!WB2SVG__APPEND(b->stack, b->stack_count, b->stack_capacity, n)) return false;
+        }
+    }
+    return true;
+}
+
+
+// Walks a pixel chain from node pixel (sx, sy) through its neighbor (x, y)
+// until the next node. Chains never leave the component of their node.
+static bool wb2svg__graph_walk(wb2svg__graph_builder* b, wb2svg_img img, int sx, int sy, int x, int y) {
+    wb2svg_graph* graph = b->graph;
+    int counts[WB2SVG__PALETTE_SIZE] = {0};
+    int from = -b->labels[sy*img.width + sx] - 1;
+    wb2svg_edge edge = {
+        .from = from,
+        .offset = graph->point_count,
+        .component = graph->nodes[from].component,
+        .color = WB2SVG__IMG_AT(img, y, x),
+    };
+
+    wb2svg_point start = { sx, sy };
+    if (!WB2SVG__APPEND(graph->points, graph->point_count, b->point_capacity, start)) return false;
+
+    int px = sx;
+    int py = sy;
+    for (;;) {
+        wb2svg_point p = { x, y };
+        if (!WB2SVG__APPEND(graph->points, graph->point_count, b->point_capacity, p)) return false;
+        int color = wb2svg__palette_index(WB2SVG__IMG_AT(img, y, x));
+        if (color >= 0) counts[color]++;
+
+        int label = b->labels[y*img.width + x];
+        if (label < 0 && label != WB2SVG__WALKED) {
+            edge.to = -label - 1;
+            break;
+        }
+        b->labels[y*img.width + x] = WB2SVG__WALKED;
+
+        // Chain pixels have exactly two skeleton neighbors: where we came from and where we go.
+        int next = -1;
+        for (int dir = 0; dir < 8; ++dir) {
+            int nx = x + wb2svg__dir_dx[dir];
+            int ny = y + wb2svg__dir_dy[dir];
+            if ((nx == px && ny == py) || !wb2svg__skeleton_at(img, nx, ny)) continue;
+            if (b->labels[ny*img.width + nx] == WB2SVG__WALKED) continue;
+            next = dir;
+            break;
+        }
+        if (next < 0) {
+            // Chain closed onto itself without a node, end it on a new one.
+            if (!wb2svg__graph_add_node(b, img, edge.component, x, y)) return false;
+            edge.to = graph->node_count - 1;
+            break;
+        }
+        px = x;
+        py = y;
+        x += wb2svg__dir_dx[next];
+        y += wb2svg__dir_dy[next];
+    }
+
+    edge.count = graph->point_count - edge.offset;
+    int best = 0;
+    for (int color = 1; color < WB2SVG__PALETTE_SIZE; ++color) {
+        if (counts[color] > counts[best]) best = color;
+    }
+    if (counts[best] > 0) edge.color = wb2svg__palette[best];
+
+    return WB2SVG__APPEND(graph->edges, graph->edge_count, b->edge_capacity, edge);
+}
+
+
+// Walks all chains leaving pixel (x, y) of a node, skipping already walked ones.
+static bool wb2svg__graph_walk_from(wb2svg__graph_builder* b, wb2svg_img img, int x, int y) {
+    for (int dir = 0; dir < 8; ++dir) {
+        int nx = x + wb2svg__dir_dx[dir];
+        int ny = y + wb2svg__dir_dy[dir];
+        if (!wb2svg__skeleton_at(img, nx, ny) || b->labels[ny*img.width + nx] <= 0) continue;
+        if (!wb2svg__graph_walk(b, img, x, y, nx, ny)) return false;
+    }
+    return true;
+}
+
+
+// Whether a pixel is an unvisited skeleton pixel of a component that is not
+// a speckle, from its label alone.
+static bool wb2svg__graph_keeps(const wb2svg_components* components, int min_component_size, int label) {
+    return label > 0 && components->items[label - 1].pixel_count >= min_component_size;
+}
+
+
+// Incident edges per node, in edge order. Degrees must be 0 before.
+static bool wb2svg__graph_adjacency(wb2svg_graph* graph) {
+    graph->adjacency = wb2svg__malloc((graph->edge_count*2 + 1)*sizeof(int));
+    if (graph->adjacency == NULL) return false;
+    for (int e = 0; e < graph->edge_count; ++e) {
+        graph->nodes[graph->edges[e].from].degree++;
+        graph->nodes[graph->edges[e].to].degree++;
+    }
+    int offset = 0;
+    for (int node = 0; node < graph->node_count; ++node) {
+        graph->nodes[node].adjacency_offset = offset;
+        offset += graph->nodes[node].degree;
+        graph->nodes[node].degree = 0;
+    }
+    for (int e = 0; e < graph->edge_count; ++e) {
+        wb2svg_node* from = &graph->nodes[graph->edges[e].from];
+        graph->adjacency[from->adjacency_offset + from->degree++] = e;
+        wb2svg_node* to = &graph->nodes[graph->edges[e].to];
+        graph->adjacency[to->adjacency_offset + to->degree++] = e;
+    }
+    return true;
+}
+
+
+// labels is width*height caller owned memory holding the component labels
+// (it may be components->labels), they are overwritten.
+static int wb2svg__graph_build(wb2svg_img img, const wb2svg_components* components, int min_component_size, int* labels, wb2svg_graph* graph) {
+    int result = 0;
+
+    memset(graph, 0, sizeof(*graph));
+    wb2svg__graph_builder b = { .graph = graph, .labels = labels };
+
+    // Nodes: clusters of endpoint, junction and isolated pixels, in raster order.
+    // Chains never leave their component, so speckles are never walked either.
+    for (int y = 0; y < img.height; ++y) {
+        for (int x = 0; x < img.width; ++x) {
+            int label = labels[y*img.width + x];
+            if (!wb2svg__graph_keeps(components, min_component_size, label)) continue;
+            if (wb2svg__skeleton_degree(img, x, y) == 2) continue;
+            if (!wb2svg__graph_add_node(&b, img, label, x, y)) WB2SVG__RETURN(-1);
         }
-    } while (path_emitted);
+    }
+
+    // Edges: chains leaving node pixels. Adjacent node pixels belong to the
+    // same cluster, so every edge has at least one chain pixel.
+    for (int y = 0; y < img.height; ++y) {
+        for (int x = 0; x < img.width; ++x) {
+            int label = labels[y*img.width + x];
+            if (label >= 0 || label == WB2SVG__WALKED) continue;
+            if (!wb2svg__graph_walk_from(&b, img, x, y)) WB2SVG__RETURN(-1);
+        }
+    }
+
+    // Closed loops have no endpoints or junctions, anchor each at its first pixel.
+    for (int y = 0; y < img.height; ++y) {
+        for (int x = 0; x < img.width; ++x) {
+            int label = labels[y*img.width + x];
+            if (!wb2svg__graph_keeps(components, min_component_size, label)) continue;
+            wb2svg_node node = { .x = x, .y = y, .pixel_count = 1, .component = label };
+            if (!WB2SVG__APPEND(graph->nodes, graph->node_count, b.node_capacity, node)) WB2SVG__RETURN(-1);
+            labels[y*img.width + x] = -graph->node_count;
+            if (!wb2svg__graph_walk_from(&b, img, x, y)) WB2SVG__RETURN(-1);
+        }
+    }
 
-    wb2svg__appendf(buffer, buffer_size, &cursor, "</svg>");
-    if (cursor < 0) WB2SVG__RETURN(cursor);
+    if (!wb2svg__graph_adjacency(graph)) WB2SVG__RETURN(-1);
 
-    result = cursor;
 defer:
-    free(processed.pixels);
+    wb2svg__free(b.stack);
+    if (result < 0) wb2svg_graph_free(graph);
+    return result;
+}
+
+
+int wb2svg_graph_build(wb2svg_img img, const wb2svg_components* components, int min_component_size, wb2svg_graph* graph) {
+    size_t size = (size_t)img.width * img.height * sizeof(int);
+    int* labels = wb2svg__malloc(size);
+    if (labels == NULL) {
+        memset(graph, 0, sizeof(*graph));
+        return -1;
+    }
+    memcpy(labels, components->labels, size);
+    int result = wb2svg__graph_build(img, components, min_component_size, labels, graph);
+    wb2svg__free(labels);
     return result;
 }
 
+
+void wb2svg_graph_free(wb2svg_graph* graph) {
+    wb2svg__free(graph->nodes);
+    wb2svg__free(graph->edges);
+    wb2svg__free(graph->points);
+    wb2svg__free(graph->adjacency);
+    memset(graph, 0, sizeof(*graph));
+}
+
+
+// Output either goes to a caller's fixed-size buffer (func == NULL, one
+// byte is kept for the terminating zero), to an owned buffer that grows
+// as needed (grow) or is staged in a small buffer that is handed to func
+// whenever it fills up.
+typedef struct {
+    char* buffer;
+    int capacity;
+    int count;
+    wb2svg_write_func* func;
+    void* context;
+    bool grow;
+    bool failed;
+    // Near the end of a fixed buffer pieces are written here first and
+    // copied over only if they fit.
+    char spill[128];
+    bool spilled;
+} wb2svg__writer;
+
+
+static void wb2svg__flush(wb2svg__writer* w) {
+    if (w->func && w->count > 0) {
+        w->func(w->context, w->buffer, w->count);
+        w->count = 0;
+    }
+}
+
+
+static void wb2svg__appendf(wb2svg__writer* w, const char* format, ...) {
+    if (w->failed) return;
+
+    for (;;) {
+        int remaining = w->capacity - w->count;
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(w->buffer + w->count, remaining, format, args);
+        va_end(args);
+
+        if (written < 0) {
+            w->failed = true;
+            return;
+        }
+        if (written < remaining) {
+            w->count += written;
+            return;
+        }
+        if (w->grow) {
+            if (written >= INT_MAX - w->count
+                || !WB2SVG__RESERVE(w->buffer, w->capacity, w->count + written + 1)) {
+                w->failed = true;
+                return;
+            }
+            continue;
+        }
+        if (!w->func) {
+            w->failed = true;
+            return;
+        }
+        if (w->count > 0) {
+            // Retry on an emptied staging buffer.
+            wb2svg__flush(w);
+            continue;
+        }
+
+        // Larger than the whole staging buffer, hand it over on its own.
+        char* chunk = wb2svg__malloc(written + 1);
+        if (chunk == NULL) {
+            w->failed = true;
+            return;
+        }
+        va_start(args, format);
+        vsnprintf(chunk, written + 1, format, args);
+        va_end(args);
+        w->func(w->context, chunk, written);
+        wb2svg__free(chunk);
+        return;
+    }
+}
+
+
+// Returns room for up to size bytes at the end of the output, flushing the
+// staging buffer if needed, or NULL once the output has failed. One byte is
+// always kept spare for the zero terminator. Commit with wb2svg__commit.
+static char* wb2svg__reserve_bytes(wb2svg__writer* w, int size) {
+    assert(size <= (int)sizeof(w->spill));
+    if (w->failed) return NULL;
+    if (w->capacity - w->count > size) return w->buffer + w->count;
+    if (w->grow) {
+        // Output past INT_MAX bytes fails like an allocation.
+        if (w->count < INT_MAX - size && WB2SVG__RESERVE(w->buffer, w->capacity, w->count + size + 1)) {
+            return w->buffer + w->count;
+        }
+        w->failed = true;
+        return NULL;
+    }
+    if (w->func) {
+        wb2svg__flush(w);
+        return w->buffer;
+    }
+    w->spilled = true;
+    return w->spill;
+}
+
+
+static void wb2svg__commit(wb2svg__writer* w, char* end) {
+    if (!w->spilled) {
+        w->count = (int)(end - w->buffer);
+        return;
+    }
+    w->spilled = false;
+    int size = (int)(end - w->spill);
+    if (w->capacity - w->count <= size) {
+        w->failed = true;
+        return;
+    }
+    memcpy(w->buffer + w->count, w->spill, size);
+    w->count += size;
+}
+
+
+static char* wb2svg__write_str(char* p, const char* str, int len) {
+    memcpy(p, str, len);
+    return p + len;
+}
+
+#define WB2SVG__WRITE_LITERAL(p, str) wb2svg__write_str((p), (str), sizeof(str) - 1)
+
+
+static const char wb2svg__digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+
+static int wb2svg__int_len(int v) {
+    int len = v < 0 ? 2 : 1;
+    unsigned int u = v < 0 ? -(unsigned int)v : (unsigned int)v;
+    while (u >= 10) {
+        u /= 10;
+        len++;
+    }
+    return len;
+}
+
+
+// Writes v in decimal, two digits at a time from the back. p needs room
+// for 11 bytes. Returns the end of the number.
+static char* wb2svg__write_int(char* p, int v) {
+    unsigned int u = v < 0 ? -(unsigned int)v : (unsigned int)v;
+    char* end = p + wb2svg__int_len(v);
+    char* q = end;
+    while (u >= 100) {
+        unsigned int pair = (u % 100) * 2;
+        u /= 100;
+        q -= 2;
+        q[0] = wb2svg__digit_pairs[pair];
+        q[1] = wb2svg__digit_pairs[pair + 1];
+    }
+    if (u >= 10) {
+        q -= 2;
+        q[0] = wb2svg__digit_pairs[u * 2];
+        q[1] = wb2svg__digit_pairs[u * 2 + 1];
+    } else {
+        *--q = (char)('0' + u);
+    }
+    if (v < 0) *p = '-';
+    return end;
+}
+
+
+// Path data writer producing the shortest text it can: per segment it
+// picks absolute or relative coordinates and L, H or V, omits the command
+// letter when it repeats and separators before negative numbers.
+typedef struct {
+    wb2svg__writer* w;
+    int x, y;            // Current point
+    char command;        // Command in effect for implicit repetition
+    bool after_number;   // Next number needs a separator unless it is negative
+} wb2svg__path_encoder;
+
+
+// Text length of a command with its arguments at the current encoder state.
+static int wb2svg__path_cost(const wb2svg__path_encoder* e, char command, const int* args, int count) {
+    bool after_number = e->after_number;
+    int cost = 0;
+    if (command != e->command) {
+        cost++;
+        after_number = false;
+    }
+    for (int i = 0; i < count; ++i) {
+        cost += wb2svg__int_len(args[i]) + (after_number && args[i] >= 0);
+        after_number = true;
+    }
+    return cost;
+}
+
+
+// Commands take at most 6 arguments of 11 bytes plus a separator each.
+#define WB2SVG__MAX_COMMAND_SIZE (1 + 6 * 12)
+
+
+static void wb2svg__path_write(wb2svg__path_encoder* e, char command, const int* args, int count) {
+    assert(count <= 6);
+    char* p = wb2svg__reserve_bytes(e->w, WB2SVG__MAX_COMMAND_SIZE);
+    if (p == NULL) return;
+
+    if (command != e->command) {
+        *p++ = command;
+        e->command = command;
+        e->after_number = false;
+    }
+    for (int i = 0; i < count; ++i) {
+        if (e->after_number && args[i] >= 0) *p++ = ' ';
+        p = wb2svg__write_int(p, args[i]);
+        e->after_number = true;
+    }
+    wb2svg__commit(e->w, p);
+}
+
+
+// Opens a <path> element, stroke is NULL when it is inherited from a group.
+static void wb2svg__path_open(wb2svg__path_encoder* e, const wb2svg_rgba* stroke) {
+    char* p = wb2svg__reserve_bytes(e->w, 64);
+    if (p != NULL) {
+        if (stroke) {
+            p = WB2SVG__WRITE_LITERAL(p, "<path fill=\"none\" stroke=\"rgb(");
+            p = wb2svg__write_int(p, stroke->r);
+            p = WB2SVG__WRITE_LITERAL(p, ", ");
+            p = wb2svg__write_int(p, stroke->g);
+            p = WB2SVG__WRITE_LITERAL(p, ", ");
+            p = wb2svg__write_int(p, stroke->b);
+            p = WB2SVG__WRITE_LITERAL(p, ")\" d=\"");
+        } else {
+            p = WB2SVG__WRITE_LITERAL(p, "<path d=\"");
+        }
+        wb2svg__commit(e->w, p);
+    }
+    e->command = 0;
+    e->after_number = false;
+}
+
+
+// Starts a subpath, relative to the end of the previous one when shorter.
+static void wb2svg__path_move(wb2svg__path_encoder* e, wb2svg_point start) {
+    int absolute[2] = { start.x, start.y };
+    int relative[2] = { start.x - e->x, start.y - e->y };
+    bool first = e->command == 0;
+    if (!first && wb2svg__path_cost(e, 'm', relative, 2) < wb2svg__path_cost(e, 'M', absolute, 2)) {
+        wb2svg__path_write(e, 'm', relative, 2);
+        e->command = 'l';
+    } else {
+        wb2svg__path_write(e, 'M', absolute, 2);
+        // Coordinates following a moveto are implicit linetos.
+        e->command = 'L';
+    }
+    e->x = start.x;
+    e->y = start.y;
+}
+
+
+typedef struct {
+    char command;
+    int args[2];
+    int count;
+} wb2svg__path_command;
+
+
+static void wb2svg__path_line(wb2svg__path_encoder* e, wb2svg_point p) {
+    int dx = p.x - e->x;
+    int dy = p.y - e->y;
+    wb2svg__path_command candidates[4];
+    int count = 0;
+
+    if (dy == 0) {
+        candidates[count++] = (wb2svg__path_command){ 'H', { p.x }, 1 };
+        candidates[count++] = (wb2svg__path_command){ 'h', { dx }, 1 };
+    } else if (dx == 0) {
+        candidates[count++] = (wb2svg__path_command){ 'V', { p.y }, 1 };
+        candidates[count++] = (wb2svg__path_command){ 'v', { dy }, 1 };
+    }
+    candidates[count++] = (wb2svg__path_command){ 'L', { p.x, p.y }, 2 };
+    candidates[count++] = (wb2svg__path_command){ 'l', { dx, dy }, 2 };
+
+    int best = 0;
+    int best_cost = INT_MAX;
+    for (int i = 0; i < count; ++i) {
+        int cost = wb2svg__path_cost(e, candidates[i].command, candidates[i].args, candidates[i].count);
+        if (cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+
+    wb2svg__path_write(e, candidates[best].command, candidates[best].args, candidates[best].count);
+    e->x = p.x;
+    e->y = p.y;
+}
+
+
+static void wb2svg__path_curve(wb2svg__path_encoder* e, wb2svg_point c1, wb2svg_point c2, wb2svg_point p) {
+    int absolute[6] = { c1.x, c1.y, c2.x, c2.y, p.x, p.y };
+    int relative[6] = {
+        c1.x - e->x, c1.y - e->y,
+        c2.x - e->x, c2.y - e->y,
+        p.x - e->x, p.y - e->y,
+    };
+    if (wb2svg__path_cost(e, 'c', relative, 6) <= wb2svg__path_cost(e, 'C', absolute, 6)) {
+        wb2svg__path_write(e, 'c', relative, 6);
+    } else {
+        wb2svg__path_write(e, 'C', absolute, 6);
+    }
+    e->x = p.x;
+    e->y = p.y;
+}
+
+
+static void wb2svg__path_end(wb2svg__path_encoder* e) {
+    char* p = wb2svg__reserve_bytes(e->w, 3);
+    if (p != NULL) wb2svg__commit(e->w, WB2SVG__WRITE_LITERAL(p, "\"/>"));
+}
+
+
+// Writes a traced chain as a subpath of the open path element. Cubic chains
+// hold the start point followed by two controls and an end point per segment.
+static void wb2svg__emit_chain(wb2svg__path_encoder* e, bool cubic, const wb2svg_point* points, int count) {
+    wb2svg__path_move(e, points[0]);
+    if (cubic) {
+        for (int i = 1; i + 2 < count && !e->w->failed; i += 3) {
+            wb2svg__path_curve(e, points[i], points[i + 1], points[i + 2]);
+        }
+    } else {
+        for (int i = 1; i < count && !e->w->failed; ++i) {
+            wb2svg__path_line(e, points[i]);
+        }
+    }
+}
+
+
+// Collects traced paths in growing arrays until they are packed into wb2svg_paths.
+typedef struct {
+    wb2svg_point* points;
+    int point_count;
+    int point_capacity;
+    int* offsets; // Start of each path
+    wb2svg_rgba* colors;
+    uint8_t* kinds;
+    int count;
+    int offsets_capacity;
+    int colors_capacity;
+    int kinds_capacity;
+} wb2svg__path_builder;
+
+
+static bool wb2svg__add_path(
+    wb2svg__path_builder* b, wb2svg_path_kind kind, wb2svg_rgba color, const wb2svg_point* points, int count
+) {
+    if (!WB2SVG__RESERVE(b->points, b->point_capacity, b->point_count + count)) return false;
+    if (!WB2SVG__RESERVE(b->offsets, b->offsets_capacity, b->count + 1)) return false;
+    if (!WB2SVG__RESERVE(b->colors, b->colors_capacity, b->count + 1)) return false;
+    if (!WB2SVG__RESERVE(b->kinds, b->kinds_capacity, b->count + 1)) return false;
+
+    memcpy(b->points + b->point_count, points, count*sizeof(wb2svg_point));
+    b->offsets[b->count] = b->point_count;
+    b->colors[b->count] = color;
+    b->kinds[b->count] = (uint8_t)kind;
+    b->point_count += count;
+    b->count++;
+    return true;
+}
+
+
+static void wb2svg__path_builder_free(wb2svg__path_builder* b) {
+    wb2svg__free(b->points);
+    wb2svg__free(b->offsets);
+    wb2svg__free(b->colors);
+    wb2svg__free(b->kinds);
+}
+
+
+// Allocates all arrays of paths at once: points and bboxes first, then the
+// 4-byte and byte arrays, so every array stays aligned.
+static bool wb2svg__alloc_paths(wb2svg_paths* paths, int width, int height, int count, int point_count) {
+    size_t points_size = (size_t)point_count*sizeof(wb2svg_point);
+    size_t bboxes_size = (size_t)count*sizeof(wb2svg_bbox);
+    size_t offsets_size = (size_t)(count + 1)*sizeof(int);
+    size_t colors_size = (size_t)count*sizeof(wb2svg_rgba);
+    size_t kinds_size = (size_t)count;
+    char* memory = wb2svg__malloc(points_size + bboxes_size + offsets_size + colors_size + kinds_size);
+    if (memory == NULL) return false;
+
+    *paths = (wb2svg_paths){
+        .width = width,
+        .height = height,
+        .count = count,
+        .point_count = point_count,
+        .points = (wb2svg_point*)memory,
+        .bboxes = (wb2svg_bbox*)(memory + points_size),
+        .offsets = (int*)(memory + points_size + bboxes_size),
+        .colors = (wb2svg_rgba*)(memory + points_size + bboxes_size + offsets_size),
+        .kinds = (uint8_t*)(memory + points_size + bboxes_size + offsets_size + colors_size),
+    };
+    paths->offsets[count] = point_count;
+    return true;
+}
+
+
+static void wb2svg__compute_bboxes(wb2svg_paths* paths) {
+    for (int i = 0; i < paths->count; ++i) {
+        // Control points count too, they bound the curve.
+        wb2svg_bbox bbox = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+        for (int j = paths->offsets[i]; j < paths->offsets[i + 1]; ++j) {
+            wb2svg_point p = paths->points[j];
+            if (p.x < bbox.x0) bbox.x0 = p.x;
+            if (p.y < bbox.y0) bbox.y0 = p.y;
+            if (p.x > bbox.x1) bbox.x1 = p.x;
+            if (p.y > bbox.y1) bbox.y1 = p.y;
+        }
+        paths->bboxes[i] = bbox;
+    }
+}
+
+
+// Moves the builder's paths into one allocation.
+static bool wb2svg__pack_paths(const wb2svg__path_builder* b, int width, int height, wb2svg_paths* paths) {
+    if (!wb2svg__alloc_paths(paths, width, height, b->count, b->point_count)) return false;
+    if (b->point_count > 0) memcpy(paths->points, b->points, b->point_count*sizeof(wb2svg_point));
+    if (b->count > 0) {
+        memcpy(paths->offsets, b->offsets, b->count*sizeof(int));
+        memcpy(paths->colors, b->colors, b->count*sizeof(wb2svg_rgba));
+        memcpy(paths->kinds, b->kinds, b->count);
+    }
+    wb2svg__compute_bboxes(paths);
+    return true;
+}
+
+
+// Ramer-Douglas-Peucker simplification in place, returns the new point count.
+// Iterative with a fixed stack: the smaller half of every split is processed
+// first, so at most log2(count) ranges are pending. keep must hold count flags.
+static int wb2svg__simplify(wb2svg_point* points, int count, float tolerance, bool* keep) {
+    if (count <= 2) return count;
+
+    struct { int first, last; } stack[64];
+    int top = 0;
+    float tolerance2 = tolerance*tolerance;
+
+    memset(keep, 0, count*sizeof(bool));
+    keep[0] = keep[count - 1] = true;
+    stack[top].first = 0;
+    stack[top].last = count - 1;
+    top++;
+
+    while (top > 0) {
+        top--;
+        int first = stack[top].first;
+        int last = stack[top].last;
+
+        for (;;) {
+            if (last - first < 2) break;
+
+            wb2svg_point a = points[first];
+            float dx = points[last].x - a.x;
+            float dy = points[last].y - a.y;
+            float len2 = dx*dx + dy*dy;
+
+            int split = -1;
+            float max_dist2 = tolerance2;
+            for (int i = first + 1; i < last; ++i) {
+                float px = points[i].x - a.x;
+                float py = points[i].y - a.y;
+                // Distance to the line through a and last, or to a for closed chains.
+                float cross = dx*py - dy*px;
+                float dist2 = len2 > 0 ? cross*cross / len2 : px*px + py*py;
+                if (dist2 > max_dist2) {
+                    max_dist2 = dist2;
+                    split = i;
+                }
+            }
+            if (split < 0) break;
+
+            keep[split] = true;
+            if (split - first < last - split) {
+                stack[top].first = split;
+                stack[top].last = last;
+                top++;
+                last = split;
+            } else {
+                stack[top].first = first;
+                stack[top].last = split;
+                top++;
+                first = split;
+            }
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < count; ++i) {
+        if (keep[i]) points[kept++] = points[i];
+    }
+    return kept;
+}
+
+
+typedef struct {
+    const wb2svg_graph* graph;
+    const wb2svg_components* components;
+    const wb2svg_options* opts;
+    bool* used;     // Per edge: already traced or pruned
+    int* remaining; // Per node: number of incident edges not yet used
+    wb2svg_point* points;
+    int count;
+    int capacity;
+    int last_edge;  // Edge traced last, walked starting at node last_start
+    int last_start;
+    int run_code;   // Chain code of the last step when merging runs, -1 after a jump
+    bool* keep;     // Simplification flags, grown along with points
+    int keep_capacity;
+    wb2svg_point* curve; // Fitted Beziers: start point, then two controls and an end per segment
+    int curve_count;
+    int curve_capacity;
+    float* params;
+    int params_capacity;
+    struct wb2svg__fit_span* spans;
+    int span_count;
+    int span_capacity;
+} wb2svg__tracer;
+
+
+typedef struct {
+    float x, y;
+} wb2svg__vec2;
+
+
+struct wb2svg__fit_span {
+    int first, last;
+    wb2svg__vec2 t1, t2; // Unit tangents at first (pointing inwards) and last (pointing inwards)
+};
+
+
+static wb2svg__vec2 wb2svg__vec2_of(wb2svg_point p) { return (wb2svg__vec2){ (float)p.x, (float)p.y }; }
+static wb2svg__vec2 wb2svg__vec2_sub(wb2svg__vec2 a, wb2svg__vec2 b) { return (wb2svg__vec2){ a.x - b.x, a.y - b.y }; }
+static wb2svg__vec2 wb2svg__vec2_add(wb2svg__vec2 a, wb2svg__vec2 b) { return (wb2svg__vec2){ a.x + b.x, a.y + b.y }; }
+static wb2svg__vec2 wb2svg__vec2_scale(wb2svg__vec2 a, float s) { return (wb2svg__vec2){ a.x*s, a.y*s }; }
+static float wb2svg__vec2_dot(wb2svg__vec2 a, wb2svg__vec2 b) { return a.x*b.x + a.y*b.y; }
+static float wb2svg__vec2_len(wb2svg__vec2 a) { return sqrtf(a.x*a.x + a.y*a.y); }
+
+
+static wb2svg__vec2 wb2svg__vec2_normalize(wb2svg__vec2 a) {
+    float len = wb2svg__vec2_len(a);
+    return len > 0 ? wb2svg__vec2_scale(a, 1.0f / len) : a;
+}
+
+
+static wb2svg__vec2 wb2svg__bezier_at(const wb2svg__vec2 b[4], float u) {
+    float v = 1.0f - u;
+    float b0 = v*v*v, b1 = 3*u*v*v, b2 = 3*u*u*v, b3 = u*u*u;
+    return (wb2svg__vec2){
+        b0*b[0].x + b1*b[1].x + b2*b[2].x + b3*b[3].x,
+        b0*b[0].y + b1*b[1].y + b2*b[2].y + b3*b[3].y,
+    };
+}
+
+
+// Unit tangent at points[i] pointing towards points[i + step], looking up
+// to a few pixels away to smooth out the pixel staircase.
+static wb2svg__vec2 wb2svg__chain_tangent(const wb2svg_point* points, int i, int step, int first, int last) {
+    const int reach = 3;
+    int j = i;
+    for (int k = 0; k < reach && j + step >= first && j + step <= last; ++k) j += step;
+    return wb2svg__vec2_normalize(wb2svg__vec2_sub(wb2svg__vec2_of(points[j]), wb2svg__vec2_of(points[i])));
+}
+
+
+// Least-squares cubic through points[first..last] with fixed end tangents
+// and parameters u (Schneider, "An Algorithm for Automatically Fitting
+// Digitized Curves", Graphics Gems, 1990).
+static void wb2svg__fit_bezier(
+    const wb2svg_point* points, const float* u, int first, int last,
+    wb2svg__vec2 t1, wb2svg__vec2 t2, wb2svg__vec2 bezier[4]
+) {
+    wb2svg__vec2 p0 = wb2svg__vec2_of(points[first]);
+    wb2svg__vec2 p3 = wb2svg__vec2_of(points[last]);
+    float c00 = 0, c01 = 0, c11 = 0, x0 = 0, x1 = 0;
+    for (int i = first; i <= last; ++i) {
+        float t = u[i - first];
+        float v = 1.0f - t;
+        float b0 = v*v*v, b1 = 3*t*v*v, b2 = 3*t*t*v, b3 = t*t*t;
+        wb2svg__vec2 a1 = wb2svg__vec2_scale(t1, b1);
+        wb2svg__vec2 a2 = wb2svg__vec2_scale(t2, b2);
+        wb2svg__vec2 rest = wb2svg__vec2_sub(
+            wb2svg__vec2_of(points[i]),
+            wb2svg__vec2_add(wb2svg__vec2_scale(p0, b0 + b1), wb2svg__vec2_scale(p3, b2 + b3))
+        );
+        c00 += wb2svg__vec2_dot(a1, a1);
+        c01 += wb2svg__vec2_dot(a1, a2);
+        c11 += wb2svg__vec2_dot(a2, a2);
+        x0 += wb2svg__vec2_dot(a1, rest);
+        x1 += wb2svg__vec2_dot(a2, rest);
+    }
+
+    float det = c00*c11 - c01*c01;
+    float alpha1 = det != 0 ? (x0*c11 - x1*c01) / det : 0;
+    float alpha2 = det != 0 ? (c00*x1 - c01*x0) / det : 0;
+
+    // Degenerate, backwards or runaway handles: fall back to a third of the chord.
+    // The error is only measured at the data points, so overlong handles could
+    // bulge out between them unnoticed.
+    float chord = wb2svg__vec2_len(wb2svg__vec2_sub(p3, p0));
+    float epsilon = 1e-3f*chord;
+    if (alpha1 < epsilon || alpha2 < epsilon || alpha1 > chord || alpha2 > chord) {
+        alpha1 = alpha2 = chord / 3.0f;
+    }
+
+    bezier[0] = p0;
+    bezier[1] = wb2svg__vec2_add(p0, wb2svg__vec2_scale(t1, alpha1));
+    bezier[2] = wb2svg__vec2_add(p3, wb2svg__vec2_scale(t2, alpha2));
+    bezier[3] = p3;
+}
+
+
+// Max squared distance between points and the curve at their parameters.
+static float wb2svg__bezier_error(
+    const wb2svg_point* points, const float* u, int first, int last,
+    const wb2svg__vec2 bezier[4], int* split
+) {
+    float max_error = 0;
+    *split = (first + last) / 2;
+    for (int i = first + 1; i < last; ++i) {
+        wb2svg__vec2 d = wb2svg__vec2_sub(wb2svg__bezier_at(bezier, u[i - first]), wb2svg__vec2_of(points[i]));
+        float error = wb2svg__vec2_dot(d, d);
+        if (error > max_error) {
+            max_error = error;
+            *split = i;
+        }
+    }
+    return max_error;
+}
+
+
+// One Newton-Raphson step per point towards the closest curve parameter.
+static void wb2svg__reparameterize(const wb2svg_point* points, float* u, int first, int last, const wb2svg__vec2 b[4]) {
+    wb2svg__vec2 d1[3], d2[2];
+    for (int i = 0; i < 3; ++i) d1[i] = wb2svg__vec2_scale(wb2svg__vec2_sub(b[i + 1], b[i]), 3.0f);
+    for (int i = 0; i < 2; ++i) d2[i] = wb2svg__vec2_scale(wb2svg__vec2_sub(d1[i + 1], d1[i]), 2.0f);
+
+    for (int i = first; i <= last; ++i) {
+        float t = u[i - first];
+        float v = 1.0f - t;
+        wb2svg__vec2 q = wb2svg__bezier_at(b, t);
+        wb2svg__vec2 q1 = wb2svg__vec2_add(
+            wb2svg__vec2_add(wb2svg__vec2_scale(d1[0], v*v), wb2svg__vec2_scale(d1[1], 2*t*v)),
+            wb2svg__vec2_scale(d1[2], t*t)
+        );
+        wb2svg__vec2 q2 = wb2svg__vec2_add(wb2svg__vec2_scale(d2[0], v), wb2svg__vec2_scale(d2[1], t));
+        wb2svg__vec2 diff = wb2svg__vec2_sub(q, wb2svg__vec2_of(points[i]));
+        float numerator = wb2svg__vec2_dot(diff, q1);
+        float denominator = wb2svg__vec2_dot(q1, q1) + wb2svg__vec2_dot(diff, q2);
+        if (denominator != 0) {
+            t -= numerator / denominator;
+            u[i - first] = t < 0 ? 0 : t > 1 ? 1 : t;
+        }
+    }
+}
+
+
+static bool wb2svg__push_span(wb2svg__tracer* t, int first, int last, wb2svg__vec2 t1, wb2svg__vec2 t2) {
+    struct wb2svg__fit_span span = { first, last, t1, t2 };
+    return WB2SVG__APPEND(t->spans, t->span_count, t->span_capacity, span);
+}
+
+
+// Appends cubic segments approximating points[first..last] to t->curve.
+// Control points are rounded to whole pixels and the error is checked after
+// rounding, so every segment stays within tolerance.
+static bool wb2svg__fit_span(wb2svg__tracer* t, const wb2svg_point* points, int first, int last, float tolerance) {
+    const int max_iterations = 4;
+    float tolerance2 = tolerance*tolerance;
+
+    t->span_count = 0;
+    wb2svg__vec2 t1 = wb2svg__chain_tangent(points, first, 1, first, last);
+    wb2svg__vec2 t2 = wb2svg__chain_tangent(points, last, -1, first, last);
+    if (!wb2svg__push_span(t, first, last, t1, t2)) return false;
+
+    // Spans are popped left to right, so segments come out in path order.
+    while (t->span_count > 0) {
+        struct wb2svg__fit_span span = t->spans[--t->span_count];
+        int n = span.last - span.first + 1;
+        wb2svg_point controls[2] = { points[span.first], points[span.last] };
+
+        if (n > 2) {
+            if (!WB2SVG__RESERVE(t->params, t->params_capacity, n)) return false;
+            float* u = t->params;
+            u[0] = 0;
+            for (int i = 1; i < n; ++i) {
+                wb2svg__vec2 d = wb2svg__vec2_sub(wb2svg__vec2_of(points[span.first + i]), wb2svg__vec2_of(points[span.first + i - 1]));
+                u[i] = u[i - 1] + wb2svg__vec2_len(d);
+            }
+            for (int i = 1; i < n; ++i) u[i] /= u[n - 1];
+
+            wb2svg__vec2 bezier[4];
+            int split = 0;
+            float error = FLT_MAX;
+            for (int iteration = 0; iteration <= max_iterations; ++iteration) {
+                if (iteration > 0) wb2svg__reparameterize(points, u, span.first, span.last, bezier);
+                wb2svg__fit_bezier(points, u, span.first, span.last, span.t1, span.t2, bezier);
+                for (int i = 0; i < 2; ++i) {
+                    controls[i] = (wb2svg_point){ (int)lroundf(bezier[i + 1].x), (int)lroundf(bezier[i + 1].y) };
+                    bezier[i + 1] = wb2svg__vec2_of(controls[i]);
+                }
+                error = wb2svg__bezier_error(points, u, span.first, span.last, bezier, &split);
+                // Reparameterization only pays off when the fit is already close.
+                if (error <= tolerance2 || error > 16*tolerance2) break;
+            }
+
+            if (error > tolerance2) {
+                wb2svg__vec2 center = wb2svg__vec2_normalize(wb2svg__vec2_sub(
+                    wb2svg__vec2_of(points[split - 1]), wb2svg__vec2_of(points[split + 1])
+                ));
+                if (center.x == 0 && center.y == 0) center = wb2svg__chain_tangent(points, split, -1, span.first, span.last);
+                if (!wb2svg__push_span(t, split, span.last, wb2svg__vec2_scale(center, -1.0f), span.t2)) return false;
+                if (!wb2svg__push_span(t, span.first, split, span.t1, center)) return false;
+                continue;
+            }
+        }
+
+        if (!WB2SVG__APPEND(t->curve, t->curve_count, t->curve_capacity, controls[0])) return false;
+        if (!WB2SVG__APPEND(t->curve, t->curve_count, t->curve_capacity, controls[1])) return false;
+        if (!WB2SVG__APPEND(t->curve, t->curve_count, t->curve_capacity, points[span.last])) return false;
+    }
+    return true;
+}
+
+
+// Fits the traced path with cubic Beziers into t->curve. The path is split
+// at corners first, so sharp turns stay sharp instead of being rounded off.
+static bool wb2svg__fit_curves(wb2svg__tracer* t, float tolerance) {
+    const int reach = 4;
+    const float corner_cos = -0.7f; // Interior angles below ~135 degrees are corners
+
+    const wb2svg_point* points = t->points;
+    int count = t->count;
+    t->curve_count = 0;
+    if (!WB2SVG__APPEND(t->curve, t->curve_count, t->curve_capacity, points[0])) return false;
+
+    int first = 0;
+    for (int i = reach; i < count - reach; ++i) {
+        wb2svg__vec2 p = wb2svg__vec2_of(points[i]);
+        wb2svg__vec2 a = wb2svg__vec2_normalize(wb2svg__vec2_sub(wb2svg__vec2_of(points[i - reach]), p));
+        wb2svg__vec2 b = wb2svg__vec2_normalize(wb2svg__vec2_sub(wb2svg__vec2_of(points[i + reach]), p));
+        float cos = wb2svg__vec2_dot(a, b);
+        if (cos <= corner_cos) continue;
+
+        // Keep only the sharpest point of a turn.
+        int sharpest = i;
+        float sharpest_cos = cos;
+        for (int j = i + 1; j < count - reach && j <= i + reach; ++j) {
+            wb2svg__vec2 q = wb2svg__vec2_of(points[j]);
+            wb2svg__vec2 qa = wb2svg__vec2_normalize(wb2svg__vec2_sub(wb2svg__vec2_of(points[j - reach]), q));
+            wb2svg__vec2 qb = wb2svg__vec2_normalize(wb2svg__vec2_sub(wb2svg__vec2_of(points[j + reach]), q));
+            float qcos = wb2svg__vec2_dot(qa, qb);
+            if (qcos > sharpest_cos) {
+                sharpest = j;
+                sharpest_cos = qcos;
+            }
+        }
+
+        if (sharpest - first >= reach) {
+            if (!wb2svg__fit_span(t, points, first, sharpest, tolerance)) return false;
+            first = sharpest;
+        }
+        i = sharpest + reach - 1;
+    }
+    if (count - 1 > first) {
+        if (!wb2svg__fit_span(t, points, first, count - 1, tolerance)) return false;
+    }
+    return true;
+}
+
+
+// Point of edge e at distance i from node end `from_node`.
+static wb2svg_point wb2svg__edge_point(const wb2svg_graph* graph, int e, int from_node, int i) {
+    const wb2svg_edge* edge = &graph->edges[e];
+    if (i >= edge->count) i = edge->count - 1;
+    if (edge->from == from_node) return graph->points[edge->offset + i];
+    return graph->points[edge->offset + edge->count - 1 - i];
+}
+
+
+static void wb2svg__use_edge(wb2svg__tracer* t, int e) {
+    t->used[e] = true;
+    t->remaining[t->graph->edges[e].from]--;
+    t->remaining[t->graph->edges[e].to]--;
+}
+
+
+// Picks the unused edge of the path color at node that continues the traced
+// path most straightly, or the first one when the path is still empty.
+static int wb2svg__next_edge(wb2svg__tracer* t, int node, wb2svg_rgba color) {
+    const int lookback = 4;
+    const wb2svg_graph* graph = t->graph;
+    const wb2svg_node* n = &graph->nodes[node];
+
+    // Incoming direction from the pixels of the last edge, so it does not
+    // depend on how the path points were merged or simplified.
+    float in_x = 0;
+    float in_y = 0;
+    if (t->last_edge >= 0) {
+        int count = graph->edges[t->last_edge].count;
+        int back = count - 1 - lookback;
+        if (back < 0) back = 0;
+        wb2svg_point end = wb2svg__edge_point(graph, t->last_edge, t->last_start, count - 1);
+        wb2svg_point start = wb2svg__edge_point(graph, t->last_edge, t->last_start, back);
+        in_x = end.x - start.x;
+        in_y = end.y - start.y;
+    }
+
+    int best = -1;
+    float best_cos = -FLT_MAX;
+    for (int i = 0; i < n->degree; ++i) {
+        int e = graph->adjacency[n->adjacency_offset + i];
+        if (t->used[e]) continue;
+        wb2svg_rgba c = graph->edges[e].color;
+        if (c.r != color.r || c.g != color.g || c.b != color.b) continue;
+        if (t->last_edge < 0) return e;
+
+        wb2svg_point first = wb2svg__edge_point(graph, e, node, 0);
+        wb2svg_point ahead = wb2svg__edge_point(graph, e, node, lookback);
+        float out_x = ahead.x - first.x;
+        float out_y = ahead.y - first.y;
+        float norm = sqrtf((in_x*in_x + in_y*in_y)*(out_x*out_x + out_y*out_y));
+        float cos = norm > 0 ? (in_x*out_x + in_y*out_y) / norm : -1.0f;
+        if (cos > best_cos) {
+            best_cos = cos;
+            best = e;
+        }
+    }
+    return best;
+}
+
+
+// Appends the next pixel of the traced path. With merge_runs a step in the
+// same chain-code direction as the previous one moves the last vertex instead,
+// so straight runs cost one point however long they are.
+static bool wb2svg__path_append(wb2svg__tracer* t, wb2svg_point p, bool merge_runs) {
+    if (t->count > 0) {
+        wb2svg_point* last = &t->points[t->count - 1];
+        if (last->x == p.x && last->y == p.y) return true;
+
+        int code = wb2svg__chain_code(p.x - last->x, p.y - last->y);
+        if (merge_runs && code >= 0 && code == t->run_code && t->count > 1) {
+            *last = p;
+            return true;
+        }
+        t->run_code = code;
+    }
+    return WB2SVG__APPEND(t->points, t->count, t->capacity, p);
+}
+
+
+// Traces one path from node, joining edges at junctions while possible.
+// Consecutive edges may end and start at different pixels of a junction
+// cluster, the path then jumps straight across it.
+// Returns false on allocation failure.
+static bool wb2svg__trace_path(wb2svg__tracer* t, int node, wb2svg__path_builder* paths) {
+    const wb2svg_graph* graph = t->graph;
+    const wb2svg_node* n = &graph->nodes[node];
+    t->count = 0;
+
+    // Isolated dots and blobs thinned to one pixel keep their component's color.
+    if (n->degree == 0) {
+        wb2svg_point p = { n->x, n->y };
+        return wb2svg__add_path(paths, WB2SVG_PATH_LINES, t->components->items[n->component - 1].color, &p, 1);
+    }
+
+    wb2svg_rgba color = {0};
+    for (int i = 0; i < n->degree; ++i) {
+        int e = graph->adjacency[n->adjacency_offset + i];
+        if (!t->used[e]) {
+            color = graph->edges[e].color;
+            break;
+        }
+    }
+
+    // Curve fitting needs every pixel, merged runs would starve the least squares.
+    bool merge_runs = t->opts->merge_runs && t->opts->curve_tolerance <= 0;
+    t->run_code = -1;
+    t->last_edge = -1;
+
+    int e;
+    while ((e = wb2svg__next_edge(t, node, color)) >= 0) {
+        wb2svg__use_edge(t, e);
+        t->last_edge = e;
+        t->last_start = node;
+        int count = graph->edges[e].count;
+        for (int i = 0; i < count; ++i) {
+            if (!wb2svg__path_append(t, wb2svg__edge_point(graph, e, node, i), merge_runs)) return false;
+        }
+        node = graph->edges[e].from == node ? graph->edges[e].to : graph->edges[e].from;
+    }
+
+    if (t->count == 0) return true;
+
+    if (t->opts->curve_tolerance > 0 && t->count > 1) {
+        if (!wb2svg__fit_curves(t, t->opts->curve_tolerance)) return false;
+        return wb2svg__add_path(paths, WB2SVG_PATH_CUBIC, color, t->curve, t->curve_count);
+    }
+
+    if (t->opts->simplify_tolerance > 0) {
+        if (!WB2SVG__RESERVE(t->keep, t->keep_capacity, t->count)) return false;
+        t->count = wb2svg__simplify(t->points, t->count, t->opts->simplify_tolerance, t->keep);
+    }
+
+    return wb2svg__add_path(paths, WB2SVG_PATH_LINES, color, t->points, t->count);
+}
+
+
+// Prunes short dangling branches while their junction keeps at least two
+// other edges, and short loops closing on a single junction.
+static void wb2svg__prune_spurs(wb2svg__tracer* t, int max_spur_length) {
+    const wb2svg_graph* graph = t->graph;
+    for (int e = 0; e < graph->edge_count; ++e) {
+        const wb2svg_edge* edge = &graph->edges[e];
+        if (edge->count - 1 > max_spur_length) continue;
+
+        int junction = edge->from;
+        if (edge->from != edge->to) {
+            int from_degree = graph->nodes[edge->from].degree;
+            int to_degree = graph->nodes[edge->to].degree;
+            junction = from_degree == 1 ? edge->to : to_degree == 1 ? edge->from : -1;
+        }
+        if (junction < 0 || t->remaining[junction] <= 2) continue;
+
+        wb2svg__use_edge(t, e);
+    }
+}
+
+
+// Traces all components in order: paths start from endpoints first, then
+// from junctions left with untraced edges (cycles), then isolated pixels.
+// Returns false on allocation failure.
+static bool wb2svg__trace_graph(
+    const wb2svg_graph* graph, const wb2svg_components* components, const wb2svg_options* opts,
+    wb2svg__path_builder* paths
+) {
+    bool result = true;
+    int* order = NULL;
+    int* component_start = NULL;
+    wb2svg__tracer t = { .graph = graph, .components = components, .opts = opts };
+    t.used = wb2svg__calloc(graph->edge_count + 1, sizeof(bool));
+    t.remaining = wb2svg__malloc((graph->node_count + 1)*sizeof(int));
+    order = wb2svg__malloc((graph->node_count + 1)*sizeof(int));
+    component_start = wb2svg__calloc(components->count + 2, sizeof(int));
+    if (!t.used || !t.remaining || !order || !component_start) WB2SVG__RETURN(false);
+
+    // Counting sort of nodes by component keeps raster order within a component.
+    for (int node = 0; node < graph->node_count; ++node) {
+        t.remaining[node] = graph->nodes[node].degree;
+        component_start[graph->nodes[node].component + 1]++;
+    }
+    for (int c = 0; c <= components->count; ++c) {
+        component_start[c + 1] += component_start[c];
+    }
+    for (int node = 0; node < graph->node_count; ++node) {
+        order[component_start[graph->nodes[node].component]++] = node;
+    }
+    for (int c = components->count; c > 0; --c) {
+        component_start[c] = component_start[c - 1];
+    }
+    component_start[0] = 0;
+
+    wb2svg__prune_spurs(&t, opts->max_spur_length);
+
+    for (int label = 1; label <= components->count; ++label) {
+        if (components->items[label - 1].pixel_count < opts->min_component_size) continue;
+
+        int begin = component_start[label];
+        int end = component_start[label + 1];
+        for (int pass = 0; pass < 3; ++pass) {
+            for (int i = begin; i < end; ++i) {
+                int node = order[i];
+                bool start = pass == 0 ? t.remaining[node] == 1
+                           : pass == 1 ? t.remaining[node] > 0
+                           : graph->nodes[node].degree == 0;
+                // Several paths may start at the same node.
+                while (start) {
+                    if (!wb2svg__trace_path(&t, node, paths)) WB2SVG__RETURN(false);
+                    start = pass < 2 && t.remaining[node] > 0;
+                }
+            }
+        }
+    }
+
+defer:
+    wb2svg__free(t.used);
+    wb2svg__free(t.remaining);
+    wb2svg__free(t.points);
+    wb2svg__free(t.keep);
+    wb2svg__free(t.curve);
+    wb2svg__free(t.params);
+    wb2svg__free(t.spans);
+    wb2svg__free(order);
+    wb2svg__free(component_start);
+    return result;
+}
+
+
+wb2svg_options wb2svg_default_options(void) {
+    return (wb2svg_options){
+        .min_component_size = 3,
+        .max_spur_length = 3,
+        .simplify_tolerance = 0.0f,
+        .curve_tolerance = 0.0f,
+        .merge_runs = true,
+        .svg_grouping = WB2SVG_SVG_PATH_PER_CHAIN,
+        .in_place = false,
+        .downscale = 1,
+    };
+}
+
+
+void wb2svg_ctx_init(wb2svg_ctx* ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+
+void wb2svg_ctx_free(wb2svg_ctx* ctx) {
+    wb2svg__free(ctx->processed);
+    wb2svg__free(ctx->rows);
+    wb2svg__free(ctx->labels);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+
+// Blur ring and thinning marks, see wb2svg_ctx.rows.
+static size_t wb2svg__row_scratch_size(int width) {
+    return (size_t)width*(WB2SVG__BLUR_ROWS*sizeof(wb2svg_rgba) + 2*sizeof(bool));
+}
+
+
+size_t wb2svg_scratch_size(int width, int height, const wb2svg_options* options) {
+    if (width <= 0 || height <= 0) return 0;
+    int factor = options && options->downscale > 1 ? options->downscale : 1;
+    size_t row_size = wb2svg__row_scratch_size(width);
+    width = wb2svg__downscaled(width, factor);
+    height = wb2svg__downscaled(height, factor);
+    size_t pixel_count = (size_t)width*height;
+    size_t size = row_size + pixel_count*sizeof(int);
+    if (factor > 1 || !(options && options->in_place)) size += pixel_count*sizeof(wb2svg_rgba);
+    return size;
+}
+
+
+// Contents are not preserved, so buffers are replaced instead of realloc'd.
+// row_width is the input width, rows are shared with the downscale box filter.
+static bool wb2svg__ctx_reserve(wb2svg_ctx* ctx, int width, int height, int row_width, bool in_place) {
+    size_t pixel_count = (size_t)width * height;
+    if (!in_place && pixel_count > ctx->processed_capacity) {
+        wb2svg__free(ctx->processed);
+        ctx->processed_capacity = 0;
+        ctx->processed = wb2svg__malloc(pixel_count * sizeof(wb2svg_rgba));
+        if (ctx->processed == NULL) return false;
+        ctx->processed_capacity = pixel_count;
+    }
+    if (row_width > ctx->row_capacity) {
+        wb2svg__free(ctx->rows);
+        ctx->row_capacity = 0;
+        ctx->rows = wb2svg__malloc(wb2svg__row_scratch_size(row_width));
+        if (ctx->rows == NULL) return false;
+        ctx->row_capacity = row_width;
+    }
+    if (pixel_count > ctx->capacity) {
+        wb2svg__free(ctx->labels);
+        ctx->capacity = 0;
+        ctx->labels = wb2svg__malloc(pixel_count * sizeof(int));
+        if (ctx->labels == NULL) return false;
+        ctx->capacity = pixel_count;
+    }
+    return true;
+}
+
+
+int wb2svg_trace_ctx(wb2svg_ctx* ctx, wb2svg_img img, const wb2svg_options* options, wb2svg_paths* paths) {
+    int result = 0;
+    wb2svg_components components = {0};
+    wb2svg_graph graph = {0};
+    wb2svg__path_builder builder = {0};
+    *paths = (wb2svg_paths){0};
+
+    wb2svg_options opts = options ? *options : wb2svg_default_options();
+
+    // A downscaled copy is processed in place.
+    int factor = opts.downscale > 1 ? opts.downscale : 1;
+    int width = wb2svg__downscaled(img.width, factor);
+    int height = wb2svg__downscaled(img.height, factor);
+    bool in_place = factor == 1 && opts.in_place && img.format == WB2SVG_FORMAT_RGBA
+        && (img.stride == 0 || img.stride == img.width*(int)sizeof(wb2svg_rgba));
+    if (!wb2svg__ctx_reserve(ctx, width, height, img.width, in_place)) return -1;
+    wb2svg_img processed = { .pixels = ctx->processed, .width = width, .height = height };
+    if (factor > 1) {
+        wb2svg__downscale(img, processed, factor, ctx->rows);
+        wb2svg__preprocess(processed, processed, ctx->rows);
+    } else {
+        if (in_place) processed.pixels = img.pixels;
+        wb2svg__preprocess(img, processed, ctx->rows);
+    }
+
+    if (wb2svg__label_components(processed, ctx->labels, &components) < 0) WB2SVG__RETURN(-1);
+    if (wb2svg__graph_build(processed, &components, opts.min_component_size, ctx->labels, &graph) < 0) WB2SVG__RETURN(-1);
+    if (!wb2svg__trace_graph(&graph, &components, &opts, &builder)) WB2SVG__RETURN(-1);
+    if (!wb2svg__pack_paths(&builder, width, height, paths)) WB2SVG__RETURN(-1);
+
+defer:
+    wb2svg__path_builder_free(&builder);
+    wb2svg_graph_free(&graph);
+    components.labels = NULL; // Owned by ctx
+    wb2svg_components_free(&components);
+    return result;
+}
+
+
+int wb2svg_trace(wb2svg_img img, const wb2svg_options* options, wb2svg_paths* paths) {
+    wb2svg_ctx ctx = {0};
+    int result = wb2svg_trace_ctx(&ctx, img, options, paths);
+    wb2svg_ctx_free(&ctx);
+    return result;
+}
+
+
+void wb2svg_paths_free(wb2svg_paths* paths) {
+    // Every array lives in the allocation starting at points.
+    wb2svg__free(paths->points);
+    *paths = (wb2svg_paths){0};
+}
+
+
+static int wb2svg__compare_color_order(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+
+// Paths sorted by color, keeping their order within a color: each key has
+// the color in its high and the path index in its low 32 bits.
+static uint64_t* wb2svg__sort_by_color(const wb2svg_paths* paths) {
+    uint64_t* keys = wb2svg__malloc((paths->count + 1)*sizeof(uint64_t));
+    if (keys == NULL) return NULL;
+    for (int i = 0; i < paths->count; ++i) {
+        wb2svg_rgba c = paths->colors[i];
+        uint32_t color = (uint32_t)c.r << 16 | (uint32_t)c.g << 8 | c.b;
+        keys[i] = (uint64_t)color << 32 | (uint32_t)i;
+    }
+    qsort(keys, paths->count, sizeof(uint64_t), wb2svg__compare_color_order);
+    return keys;
+}
+
+
+static void wb2svg__write_svg_open(wb2svg__writer* w, int width, int height) {
+    wb2svg__appendf(
+        w, "<svg width=\"%d\" height=\"%d\" xmlns=\"http://www.w3.org/2000/svg\">",
+        width, height
+    );
+}
+
+
+static int wb2svg__write_paths_svg(const wb2svg_paths* paths, wb2svg_svg_grouping grouping, wb2svg__writer* w) {
+    if (w->grow && w->capacity == 0) {
+        // Compact path data takes 2-5 bytes per point, plus the path tag.
+        // Only a first size, clamped so it fits an int; the buffer grows past it.
+        size_t estimate = 256 + (size_t)paths->point_count*5 + (size_t)paths->count*48;
+        if (estimate > INT_MAX/2) estimate = INT_MAX/2;
+        if (!WB2SVG__RESERVE(w->buffer, w->capacity, (int)estimate)) return -1;
+    }
+
+    uint64_t* keys = NULL;
+    if (grouping != WB2SVG_SVG_PATH_PER_CHAIN && !(keys = wb2svg__sort_by_color(paths))) return -1;
+
+    wb2svg__write_svg_open(w, paths->width, paths->height);
+    wb2svg__path_encoder e = { .w = w };
+    for (int k = 0; k < paths->count && !w->failed; ++k) {
+        int i = keys ? (int)(uint32_t)keys[k] : k;
+        bool first = !keys || k == 0 || keys[k] >> 32 != keys[k - 1] >> 32;
+        bool last = !keys || k == paths->count - 1 || keys[k] >> 32 != keys[k + 1] >> 32;
+        wb2svg_rgba color = paths->colors[i];
+        const wb2svg_point* points = paths->points + paths->offsets[i];
+        int count = paths->offsets[i + 1] - paths->offsets[i];
+        bool cubic = paths->kinds[i] == WB2SVG_PATH_CUBIC;
+
+        if (grouping == WB2SVG_SVG_GROUP_PER_COLOR && first) {
+            wb2svg__appendf(w, "<g fill=\"none\" stroke=\"rgb(%d, %d, %d)\">", color.r, color.g, color.b);
+        }
+        if (grouping != WB2SVG_SVG_PATH_PER_COLOR || first) {
+            wb2svg__path_open(&e, grouping == WB2SVG_SVG_GROUP_PER_COLOR ? NULL : &color);
+        }
+        wb2svg__emit_chain(&e, cubic, points, count);
+        if (grouping != WB2SVG_SVG_PATH_PER_COLOR || last) wb2svg__path_end(&e);
+        if (grouping == WB2SVG_SVG_GROUP_PER_COLOR && last) wb2svg__appendf(w, "</g>");
+    }
+    wb2svg__appendf(w, "</svg>");
+    wb2svg__flush(w);
+    wb2svg__free(keys);
+    return w->failed ? -1 : 0;
+}
+
+
+static int wb2svg__write_svg(wb2svg_img img, const wb2svg_options* options, wb2svg__writer* w) {
+    wb2svg_paths paths;
+    if (wb2svg_trace(img, options, &paths) < 0) return -1;
+    wb2svg_svg_grouping grouping = options ? options->svg_grouping : WB2SVG_SVG_PATH_PER_CHAIN;
+    int result = wb2svg__write_paths_svg(&paths, grouping, w);
+    wb2svg_paths_free(&paths);
+    return result;
+}
+
+
+int wb2svg_wb2svg(wb2svg_img img, char* buffer, int buffer_size) {
+    return wb2svg_wb2svg_ex(img, NULL, buffer, buffer_size);
+}
+
+
+int wb2svg_wb2svg_ex(wb2svg_img img, const wb2svg_options* options, char* buffer, int buffer_size) {
+    if (!buffer || buffer_size <= 0) return -1;
+
+    wb2svg__writer w = { .buffer = buffer, .capacity = buffer_size };
+    if (wb2svg__write_svg(img, options, &w) < 0) return -1;
+    // Direct writes leave the output unterminated, the spare byte is kept for this.
+    buffer[w.count] = '\0';
+    return w.count;
+}
+
+
+int wb2svg_wb2svg_to_func(wb2svg_write_func* func, void* context, wb2svg_img img, const wb2svg_options* options) {
+    if (!func) return -1;
+
+    char buffer[WB2SVG_WRITE_BUFFER_SIZE];
+    wb2svg__writer w = { .buffer = buffer, .capacity = sizeof(buffer), .func = func, .context = context };
+    return wb2svg__write_svg(img, options, &w);
+}
+
+
+int wb2svg_paths_to_svg(const wb2svg_paths* paths, const wb2svg_options* options, char* buffer, int buffer_size) {
+    if (!buffer || buffer_size <= 0) return -1;
+
+    wb2svg_svg_grouping grouping = options ? options->svg_grouping : WB2SVG_SVG_PATH_PER_CHAIN;
+    wb2svg__writer w = { .buffer = buffer, .capacity = buffer_size };
+    if (wb2svg__write_paths_svg(paths, grouping, &w) < 0) return -1;
+    buffer[w.count] = '\0';
+    return w.count;
+}
+
+
+int wb2svg_paths_to_svg_func(
+    wb2svg_write_func* func, void* context, const wb2svg_paths* paths, const wb2svg_options* options
+) {
+    if (!func) return -1;
+
+    wb2svg_svg_grouping grouping = options ? options->svg_grouping : WB2SVG_SVG_PATH_PER_CHAIN;
+    char buffer[WB2SVG_WRITE_BUFFER_SIZE];
+    wb2svg__writer w = { .buffer = buffer, .capacity = sizeof(buffer), .func = func, .context = context };
+    return wb2svg__write_paths_svg(paths, grouping, &w);
+}
+
+
+// Strips are preprocessed with this many extra source rows above and below:
+// wrong values at a cut spread 2 rows through the blur and 1 row per
+// thinning pass, of which there are 6.
+#define WB2SVG__STRIP_OVERLAP 8
+
+
+// Strip mode builds the graph of wb2svg__graph_build as the rows arrive. A
+// row is added once the row below it is preprocessed, so the degrees of its
+// pixels are known. Chains are carried from row to row as their pixels and
+// open ends, and become edges of their component when both ends reach a
+// node. Once the rows have passed a component its graph is traced and freed.
+
+
+// A cluster of node pixels.
+typedef struct {
+    int x, y;        // First pixel
+    int pixel_count;
+    int parent;      // Union-find over touching clusters, the root has the first pixel
+    int index;       // Node index while its component is traced
+} wb2svg__strip_node;
+
+
+typedef struct {
+    int64_t first;   // Raster index of the node's first pixel
+    int slot;
+} wb2svg__strip_node_ref;
+
+
+// An end of a chain: its last chain pixel, then the node pixel beyond it.
+typedef struct {
+    wb2svg_point pixel;
+    wb2svg_point node_pixel;
+    int node;        // Node slot, -1 while the end is open
+    int node_color;  // Palette index of node_pixel
+} wb2svg__strip_end;
+
+
+// A pixel chain with an open end. Its pixels are head reversed, then tail,
+// so it grows at both ends.
+typedef struct {
+    wb2svg_point* head;
+    int head_count;
+    int head_capacity;
+    wb2svg_point* tail;
+    int tail_count;
+    int tail_capacity;
+    wb2svg__strip_end end[2]; // At the first and the last pixel
+    int counts[WB2SVG__PALETTE_SIZE];
+} wb2svg__strip_chain;
+
+
+// A finished chain, oriented the way wb2svg__graph_build walks it.
+typedef struct {
+    int64_t key;     // Raster index of the first pixel times 8, plus the direction of the first step
+    int from, to;    // Node slots
+    int offset;      // Pixels are points[offset..+count] of the component
+    int count;
+    wb2svg_rgba color;
+} wb2svg__strip_edge;
+
+
+// Graph of a component in no particular order, sorted when it is traced.
+typedef struct {
+    wb2svg__strip_node_ref* nodes; // Merged clusters included
+    int node_count;
+    int node_capacity;
+    wb2svg__strip_edge* edges;
+    int edge_count;
+    int edge_capacity;
+    wb2svg_point* points;
+    int point_count;
+    int point_capacity;
+} wb2svg__strip_graph;
+
+
+// A component the rows have not passed yet.
+typedef struct {
+    int64_t first;   // Raster index of the first pixel, components are numbered in this order
+    int last_row;
+    int parent;      // Union-find, merged components point to the surviving one
+    int pixel_count;
+    int counts[WB2SVG__PALETTE_SIZE];
+    wb2svg__strip_graph graph;
+} wb2svg__strip_component;
+
+
+// Paths [begin, end) collected for a traced component.
+typedef struct {
+    int64_t first;
+    int begin, end;
+} wb2svg__strip_done;
+
+
+typedef struct {
+    int width, height;
+    int strip_height;
+    const wb2svg_options* opts;
+    wb2svg_rgba* skeleton; // Ring of 3 preprocessed rows
+    int* labels;     // 2 rows of component slots, -1 for white pixels
+    int* refs;       // 2 rows: chain slot of chain pixels, -(node slot + 1) for node pixels
+    // Slots are recycled once their component is traced or merged.
+    wb2svg__strip_component* components;
+    int component_count;
+    int component_capacity;
+    int* free_slots;
+    int free_count;
+    int free_capacity;
+    int* merged;     // Merged this row, freed once the row no longer refers to them
+    int merged_count;
+    int merged_capacity;
+    int* open;       // Component roots, possibly merged since
+    int open_count;
+    int open_capacity;
+    // Node slots are recycled with their component, chain slots once they are edges.
+    wb2svg__strip_node* nodes;
+    int node_count;
+    int node_capacity;
+    int* free_nodes;
+    int free_node_count;
+    int free_node_capacity;
+    wb2svg__strip_chain* chains;
+    int chain_count;
+    int chain_capacity;
+    int* free_chains;
+    int free_chain_count;
+    int free_chain_capacity;
+    wb2svg_node* graph_nodes; // Scratch for tracing one component
+    int graph_node_capacity;
+    wb2svg_edge* graph_edges;
+    int graph_edge_capacity;
+    // Output is written through w when set, collected in paths otherwise.
+    wb2svg__writer* w;
+    wb2svg__path_encoder e;
+    wb2svg__path_builder paths;
+    wb2svg__strip_done* done;
+    int done_count;
+    int done_capacity;
+} wb2svg__strips;
+
+
+static void wb2svg__strips_free(wb2svg__strips* s) {
+    wb2svg__free(s->skeleton);
+    wb2svg__free(s->labels);
+    wb2svg__free(s->refs);
+    for (int i = 0; i < s->component_count; ++i) {
+        wb2svg__free(s->components[i].graph.nodes);
+        wb2svg__free(s->components[i].graph.edges);
+        wb2svg__free(s->components[i].graph.points);
+    }
+    wb2svg__free(s->components);
+    wb2svg__free(s->free_slots);
+    wb2svg__free(s->merged);
+    wb2svg__free(s->open);
+    wb2svg__free(s->nodes);
+    wb2svg__free(s->free_nodes);
+    for (int i = 0; i < s->chain_count; ++i) {
+        wb2svg__free(s->chains[i].head);
+        wb2svg__free(s->chains[i].tail);
+    }
+    wb2svg__free(s->chains);
+    wb2svg__free(s->free_chains);
+    wb2svg__free(s->graph_nodes);
+    wb2svg__free(s->graph_edges);
+    wb2svg__path_builder_free(&s->paths);
+    wb2svg__free(s->done);
+}
+
+
+static bool wb2svg__strip_skeleton_at(const wb2svg__strips* s, int x, int y) {
+    if (x < 0 || x >= s->width || y < 0 || y >= s->height) return false;
+    return !WB2SVG__IS_WHITE(s->skeleton[(size_t)(y % 3)*s->width + x]);
+}
+
+
+static int wb2svg__strip_degree(const wb2svg__strips* s, int x, int y) {
+    int degree = 0;
+    for (int dir = 0; dir < 8; ++dir) {
+        degree += wb2svg__strip_skeleton_at(s, x + wb2svg__dir_dx[dir], y + wb2svg__dir_dy[dir]);
+    }
+    return degree;
+}
+
+
+static int wb2svg__strip_color(const wb2svg__strips* s, wb2svg_point p) {
+    return wb2svg__palette_index(s->skeleton[(size_t)(p.y % 3)*s->width + p.x]);
+}
+
+
+// Preprocessed pixels all have palette colors, so some count is positive.
+static wb2svg_rgba wb2svg__strip_majority(const int* counts) {
+    int best = 0;
+    for (int color = 1; color < WB2SVG__PALETTE_SIZE; ++color) {
+        if (counts[color] > counts[best]) best = color;
+    }
+    return wb2svg__palette[best];
+}
+
+
+static int wb2svg__strip_find(wb2svg__strips* s, int slot) {
+    wb2svg__strip_component* c = s->components;
+    while (c[slot].parent != slot) {
+        c[slot].parent = c[c[slot].parent].parent;
+        slot = c[slot].parent;
+    }
+    return slot;
+}
+
+
+// Returns the slot of a new component at (x, y), -1 on allocation failure.
+static int wb2svg__strip_new_component(wb2svg__strips* s, int x, int y) {
+    int slot;
+    if (s->free_count > 0) {
+        slot = s->free_slots[--s->free_count];
+    } else {
+        wb2svg__strip_component empty = {0};
+        if (!WB2SVG__APPEND(s->components, s->component_count, s->component_capacity, empty)) return -1;
+        slot = s->component_count - 1;
+    }
+    if (!WB2SVG__APPEND(s->open, s->open_count, s->open_capacity, slot)) return -1;
+    wb2svg__strip_component* c = &s->components[slot];
+    c->first = (int64_t)y*s->width + x;
+    c->last_row = y;
+    c->parent = slot;
+    c->pixel_count = 0;
+    memset(c->counts, 0, sizeof(c->counts));
+    return slot;
+}
+
+
+// Merges the components of roots a and b into the one starting first.
+// Returns the surviving root, -1 on allocation failure.
+static int wb2svg__strip_union(wb2svg__strips* s, int a, int b) {
+    if (a == b) return a;
+    if (s->components[b].first < s->components[a].first) {
+        int t = a;
+        a = b;
+        b = t;
+    }
+    if (!WB2SVG__APPEND(s->merged, s->merged_count, s->merged_capacity, b)) return -1;
+
+    wb2svg__strip_component* root = &s->components[a];
+    wb2svg__strip_component* child = &s->components[b];
+    // Order does not matter until tracing, so the smaller graph is appended to the larger.
+    if (child->graph.point_count > root->graph.point_count) {
+        wb2svg__strip_graph t = root->graph;
+        root->graph = child->graph;
+        child->graph = t;
+    }
+    wb2svg__strip_graph* to = &root->graph;
+    wb2svg__strip_graph* from = &child->graph;
+    if (!WB2SVG__RESERVE(to->nodes, to->node_capacity, to->node_count + from->node_count)) return -1;
+    if (!WB2SVG__RESERVE(to->edges, to->edge_capacity, to->edge_count + from->edge_count)) return -1;
+    if (!WB2SVG__RESERVE(to->points, to->point_capacity, to->point_count + from->point_count)) return -1;
+    if (from->node_count > 0) memcpy(to->nodes + to->node_count, from->nodes, from->node_count*sizeof(*from->nodes));
+    for (int i = 0; i < from->edge_count; ++i) {
+        wb2svg__strip_edge edge = from->edges[i];
+        edge.offset += to->point_count;
+        to->edges[to->edge_count + i] = edge;
+    }
+    if (from->point_count > 0) memcpy(to->points + to->point_count, from->points, from->point_count*sizeof(wb2svg_point));
+    to->node_count += from->node_count;
+    to->edge_count += from->edge_count;
+    to->point_count += from->point_count;
+    from->node_count = 0;
+    from->edge_count = 0;
+    from->point_count = 0;
+
+    root->pixel_count += child->pixel_count;
+    for (int color = 0; color < WB2SVG__PALETTE_SIZE; ++color) root->counts[color] += child->counts[color];
+    if (child->last_row > root->last_row) root->last_row = child->last_row;
+    child->parent = a;
+    return a;
+}
+
+
+static int wb2svg__strip_node_find(wb2svg__strips* s, int slot) {
+    wb2svg__strip_node* n = s->nodes;
+    while (n[slot].parent != slot) {
+        n[slot].parent = n[n[slot].parent].parent;
+        slot = n[slot].parent;
+    }
+    return slot;
+}
+
+
+// Returns the slot of a new node at pixel (x, y) of component, -1 on allocation failure.
+static int wb2svg__strip_new_node(wb2svg__strips* s, int component, int x, int y) {
+    int slot;
+    if (s->free_node_count > 0) {
+        slot = s->free_nodes[--s->free_node_count];
+    } else {
+        wb2svg__strip_node empty = {0};
+        if (!WB2SVG__APPEND(s->nodes, s->node_count, s->node_capacity, empty)) return -1;
+        slot = s->node_count - 1;
+    }
+    s->nodes[slot] = (wb2svg__strip_node){ .x = x, .y = y, .pixel_count = 1, .parent = slot };
+    wb2svg__strip_graph* g = &s->components[component].graph;
+    wb2svg__strip_node_ref ref = { .first = (int64_t)y*s->width + x, .slot = slot };
+    if (!WB2SVG__APPEND(g->nodes, g->node_count, g->node_capacity, ref)) return -1;
+    return slot;
+}
+
+
+// Merges the clusters of nodes a and b, returns the root.
+static int wb2svg__strip_node_union(wb2svg__strips* s, int a, int b) {
+    a = wb2svg__strip_node_find(s, a);
+    b = wb2svg__strip_node_find(s, b);
+    if (a == b) return a;
+    const wb2svg__strip_node* na = &s->nodes[a];
+    const wb2svg__strip_node* nb = &s->nodes[b];
+    if (nb->y < na->y || (nb->y == na->y && nb->x < na->x)) {
+        int t = a;
+        a = b;
+        b = t;
+    }
+    s->nodes[b].parent = a;
+    s->nodes[a].pixel_count += s->nodes[b].pixel_count;
+    return a;
+}
+
+
+static int wb2svg__strip_chain_count(const wb2svg__strip_chain* c) {
+    return c->head_count + c->tail_count;
+}
+
+
+static wb2svg_point wb2svg__strip_chain_at(const wb2svg__strip_chain* c, int i) {
+    return i < c->head_count ? c->head[c->head_count - 1 - i] : c->tail[i - c->head_count];
+}
+
+
+// Extends the chain at end by pixel p.
+static bool wb2svg__strip_chain_push(wb2svg__strip_chain* c, int end, wb2svg_point p) {
+    c->end[end].pixel = p;
+    if (end == 0) return WB2SVG__APPEND(c->head, c->head_count, c->head_capacity, p);
+    return WB2SVG__APPEND(c->tail, c->tail_count, c->tail_capacity, p);
+}
+
+
+// The open end of the chain at pixel p. A chain of one pixel has both there.
+static int wb2svg__strip_open_end(const wb2svg__strip_chain* c, wb2svg_point p) {
+    for (int end = 0; end < 2; ++end) {
+        const wb2svg__strip_end* e = &c->end[end];
+        if (e->node < 0 && e->pixel.x == p.x && e->pixel.y == p.y) return end;
+    }
+    assert(false && "chain pixel without an open end");
+    return 0;
+}
+
+
+// Returns the slot of a new chain of pixel p, -1 on allocation failure.
+static int wb2svg__strip_new_chain(wb2svg__strips* s, wb2svg_point p) {
+    int slot;
+    if (s->free_chain_count > 0) {
+        slot = s->free_chains[--s->free_chain_count];
+    } else {
+        wb2svg__strip_chain empty = {0};
+        if (!WB2SVG__APPEND(s->chains, s->chain_count, s->chain_capacity, empty)) return -1;
+        slot = s->chain_count - 1;
+    }
+    wb2svg__strip_chain* c = &s->chains[slot];
+    c->head_count = 0;
+    c->tail_count = 0;
+    c->end[0] = c->end[1] = (wb2svg__strip_end){ .pixel = p, .node = -1 };
+    memset(c->counts, 0, sizeof(c->counts));
+    int color = wb2svg__strip_color(s, p);
+    if (color >= 0) c->counts[color]++;
+    if (!WB2SVG__APPEND(c->tail, c->tail_count, c->tail_capacity, p)) return -1;
+    return slot;
+}
+
+
+static int* wb2svg__strip_ref(wb2svg__strips* s, wb2svg_point p) {
+    return &s->refs[(size_t)(p.y & 1)*s->width + p.x];
+}
+
+
+// Joins chains a and b at their touching open ends, appending the shorter
+// one to the longer. Returns the surviving slot, -1 on allocation failure.
+static int wb2svg__strip_join(wb2svg__strips* s, int a, int a_end, int b, int b_end) {
+    if (wb2svg__strip_chain_count(&s->chains[a]) < wb2svg__strip_chain_count(&s->chains[b])) {
+        int t = a;
+        a = b;
+        b = t;
+        t = a_end;
+        a_end = b_end;
+        b_end = t;
+    }
+    wb2svg__strip_chain* to = &s->chains[a];
+    const wb2svg__strip_chain* from = &s->chains[b];
+    int count = wb2svg__strip_chain_count(from);
+    for (int i = 0; i < count; ++i) {
+        wb2svg_point p = wb2svg__strip_chain_at(from, b_end == 0 ? i : count - 1 - i);
+        if (!wb2svg__strip_chain_push(to, a_end, p)) return -1;
+    }
+    to->end[a_end] = from->end[1 - b_end];
+    for (int color = 0; color < WB2SVG__PALETTE_SIZE; ++color) to->counts[color] += from->counts[color];
+    // The far end of b may be open in the last two rows, it leads to a now.
+    if (to->end[a_end].node < 0) *wb2svg__strip_ref(s, to->end[a_end].pixel) = a;
+    if (!WB2SVG__APPEND(s->free_chains, s->free_chain_count, s->free_chain_capacity, b)) return -1;
+    return a;
+}
+
+
+// Key of the walk leaving node pixel start towards chain pixel next.
+static int64_t wb2svg__strip_key(const wb2svg__strips* s, wb2svg_point start, wb2svg_point next) {
+    return ((int64_t)start.y*s->width + start.x)*8 + wb2svg__chain_code(next.x - start.x, next.y - start.y);
+}
+
+
+// Turns a chain with both ends at nodes into an edge of component.
+// wb2svg__graph_build walks it from the end it scans first.
+static bool wb2svg__strip_finish(wb2svg__strips* s, int slot, int component) {
+    const wb2svg__strip_chain* c = &s->chains[slot];
+    wb2svg__strip_graph* g = &s->components[component].graph;
+    int64_t keys[2] = {
+        wb2svg__strip_key(s, c->end[0].node_pixel, c->end[0].pixel),
+        wb2svg__strip_key(s, c->end[1].node_pixel, c->end[1].pixel),
+    };
+    int start = keys[1] < keys[0];
+    int count = wb2svg__strip_chain_count(c);
+    if (!WB2SVG__RESERVE(g->points, g->point_capacity, g->point_count + count + 2)) return false;
+
+    // Colors are counted as in wb2svg__graph_walk: the chain and the node pixel it ends at.
+    int counts[WB2SVG__PALETTE_SIZE];
+    memcpy(counts, c->counts, sizeof(counts));
+    if (c->end[1 - start].node_color >= 0) counts[c->end[1 - start].node_color]++;
+    wb2svg__strip_edge edge = {
+        .key = keys[start],
+        .from = c->end[start].node,
+        .to = c->end[1 - start].node,
+        .offset = g->point_count,
+        .count = count + 2,
+        .color = wb2svg__strip_majority(counts),
+    };
+    g->points[g->point_count++] = c->end[start].node_pixel;
+    for (int i = 0; i < count; ++i) {
+        g->points[g->point_count++] = wb2svg__strip_chain_at(c, start == 0 ? i : count - 1 - i);
+    }
+    g->points[g->point_count++] = c->end[1 - start].node_pixel;
+
+    if (!WB2SVG__APPEND(g->edges, g->edge_count, g->edge_capacity, edge)) return false;
+    return WB2SVG__APPEND(s->free_chains, s->free_chain_count, s->free_chain_capacity, slot);
+}
+
+
+// Turns a chain closed onto itself into a loop of component, anchored at
+// its first pixel and walked towards the neighbor in the first direction.
+static bool wb2svg__strip_finish_loop(wb2svg__strips* s, int slot, int component) {
+    const wb2svg__strip_chain* c = &s->chains[slot];
+    int count = wb2svg__strip_chain_count(c);
+    int anchor = 0;
+    for (int i = 1; i < count; ++i) {
+        wb2svg_point p = wb2svg__strip_chain_at(c, i);
+        wb2svg_point first = wb2svg__strip_chain_at(c, anchor);
+        if (p.y < first.y || (p.y == first.y && p.x < first.x)) anchor = i;
+    }
+    wb2svg_point a = wb2svg__strip_chain_at(c, anchor);
+    wb2svg_point next = wb2svg__strip_chain_at(c, (anchor + 1) % count);
+    wb2svg_point previous = wb2svg__strip_chain_at(c, (anchor + count - 1) % count);
+    int step = wb2svg__chain_code(next.x - a.x, next.y - a.y) < wb2svg__chain_code(previous.x - a.x, previous.y - a.y)
+        ? 1 : count - 1;
+
+    int node = wb2svg__strip_new_node(s, component, a.x, a.y);
+    if (node < 0) return false;
+    wb2svg__strip_graph* g = &s->components[component].graph;
+    if (!WB2SVG__RESERVE(g->points, g->point_capacity, g->point_count + count + 1)) return false;
+    wb2svg__strip_edge edge = {
+        .key = wb2svg__strip_key(s, a, wb2svg__strip_chain_at(c, (anchor + step) % count)),
+        .from = node,
+        .to = node,
+        .offset = g->point_count,
+        .count = count + 1,
+        .color = wb2svg__strip_majority(c->counts),
+    };
+    for (int i = 0, k = anchor; i <= count; ++i, k = (k + step) % count) {
+        g->points[g->point_count++] = wb2svg__strip_chain_at(c, k);
+    }
+
+    if (!WB2SVG__APPEND(g->edges, g->edge_count, g->edge_capacity, edge)) return false;
+    return WB2SVG__APPEND(s->free_chains, s->free_chain_count, s->free_chain_capacity, slot);
+}
+
+
+// Adds skeleton pixel (x, y) of component to the graph. Of its neighbors,
+// W, NW, N and NE are already added.
+static bool wb2svg__strip_add_pixel(wb2svg__strips* s, int component, int x, int y) {
+    int* previous = &s->refs[(size_t)((y + 1) & 1)*s->width];
+    int* current = &s->refs[(size_t)(y & 1)*s->width];
+    wb2svg_point p = { x, y };
+
+    if (wb2svg__strip_degree(s, x, y) != 2) {
+        // Node pixel: it joins the clusters of added neighbors and ends their chains.
+        int node = -1;
+        for (int dir = 4; dir < 8; ++dir) {
+            int nx = x + wb2svg__dir_dx[dir];
+            int ny = y + wb2svg__dir_dy[dir];
+            if (!wb2svg__strip_skeleton_at(s, nx, ny)) continue;
+            int ref = ny == y ? current[nx] : previous[nx];
+            if (ref >= 0) continue;
+            node = node < 0 ? wb2svg__strip_node_find(s, -ref - 1) : wb2svg__strip_node_union(s, node, -ref - 1);
+        }
+        if (node < 0) {
+            node = wb2svg__strip_new_node(s, component, x, y);
+            if (node < 0) return false;
+        } else {
+            s->nodes[node].pixel_count++;
+        }
+        current[x] = -(node + 1);
+
+        int color = wb2svg__strip_color(s, p);
+        for (int dir = 4; dir < 8; ++dir) {
+            int nx = x + wb2svg__dir_dx[dir];
+            int ny = y + wb2svg__dir_dy[dir];
+            if (!wb2svg__strip_skeleton_at(s, nx, ny)) continue;
+            int ref = ny == y ? current[nx] : previous[nx];
+            if (ref < 0) continue;
+            wb2svg__strip_chain* c = &s->chains[ref];
+            wb2svg__strip_end* end = &c->end[wb2svg__strip_open_end(c, (wb2svg_point){ nx, ny })];
+            end->node_pixel = p;
+            end->node = node;
+            end->node_color = color;
+            if (c->end[0].node >= 0 && c->end[1].node >= 0 && !wb2svg__strip_finish(s, ref, component)) return false;
+        }
+        return true;
+    }
+
+    // Chain pixel: it extends or joins the chains of added neighbors, or ends at their nodes.
+    int chain = -1;
+    for (int dir = 4; dir < 8; ++dir) {
+        int nx = x + wb2svg__dir_dx[dir];
+        int ny = y + wb2svg__dir_dy[dir];
+        if (!wb2svg__strip_skeleton_at(s, nx, ny)) continue;
+        int ref = ny == y ? current[nx] : previous[nx];
+        wb2svg_point q = { nx, ny };
+        if (ref < 0) {
+            if (chain < 0 && (chain = wb2svg__strip_new_chain(s, p)) < 0) return false;
+            wb2svg__strip_chain* c = &s->chains[chain];
+            wb2svg__strip_end* end = &c->end[wb2svg__strip_open_end(c, p)];
+            end->node_pixel = q;
+            end->node = -ref - 1;
+            end->node_color = wb2svg__strip_color(s, q);
+        } else if (chain < 0) {
+            wb2svg__strip_chain* c = &s->chains[ref];
+            if (!wb2svg__strip_chain_push(c, wb2svg__strip_open_end(c, q), p)) return false;
+            int color = wb2svg__strip_color(s, p);
+            if (color >= 0) c->counts[color]++;
+            chain = ref;
+        } else if (ref == chain) {
+            // Both ends met: a closed loop without nodes.
+            return wb2svg__strip_finish_loop(s, chain, component);
+        } else {
+            int end = wb2svg__strip_open_end(&s->chains[chain], p);
+            chain = wb2svg__strip_join(s, chain, end, ref, wb2svg__strip_open_end(&s->chains[ref], q));
+            if (chain < 0) return false;
+        }
+    }
+    if (chain < 0 && (chain = wb2svg__strip_new_chain(s, p)) < 0) return false;
+    const wb2svg__strip_chain* c = &s->chains[chain];
+    if (c->end[0].node >= 0 && c->end[1].node >= 0) return wb2svg__strip_finish(s, chain, component);
+    current[x] = chain;
+    return true;
+}
+
+
+static int wb2svg__compare_strip_nodes(const void* a, const void* b) {
+    int64_t x = ((const wb2svg__strip_node_ref*)a)->first, y = ((const wb2svg__strip_node_ref*)b)->first;
+    return x < y ? -1 : x > y;
+}
+
+
+static int wb2svg__compare_strip_edges(const void* a, const void* b) {
+    int64_t x = ((const wb2svg__strip_edge*)a)->key, y = ((const wb2svg__strip_edge*)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+
+// Writes the collected paths and clears them.
+static bool wb2svg__strip_write(wb2svg__strips* s) {
+    wb2svg__path_builder* b = &s->paths;
+    for (int i = 0; i < b->count; ++i) {
+        int end = i + 1 < b->count ? b->offsets[i + 1] : b->point_count;
+        wb2svg__path_open(&s->e, &b->colors[i]);
+        wb2svg__emit_chain(&s->e, b->kinds[i] == WB2SVG_PATH_CUBIC, b->points + b->offsets[i], end - b->offsets[i]);
+        wb2svg__path_end(&s->e);
+    }
+    b->count = 0;
+    b->point_count = 0;
+    return !s->w->failed;
+}
+
+
+// Traces the graph of a component the rows have passed. Nodes and edges
+// are numbered in the order wb2svg__graph_build finds them, so the paths
+// are the same as on the whole image.
+static bool wb2svg__strip_trace(wb2svg__strips* s, wb2svg__strip_component* c) {
+    wb2svg__strip_graph* g = &c->graph;
+    if (g->node_count > 1) qsort(g->nodes, g->node_count, sizeof(*g->nodes), wb2svg__compare_strip_nodes);
+    if (g->edge_count > 1) qsort(g->edges, g->edge_count, sizeof(*g->edges), wb2svg__compare_strip_edges);
+    if (!WB2SVG__RESERVE(s->graph_nodes, s->graph_node_capacity, g->node_count)) return false;
+    if (!WB2SVG__RESERVE(s->graph_edges, s->graph_edge_capacity, g->edge_count)) return false;
+
+    wb2svg_graph graph = {
+        .nodes = s->graph_nodes,
+        .edges = s->graph_edges,
+        .points = g->points,
+        .point_count = g->point_count,
+    };
+    for (int i = 0; i < g->node_count; ++i) {
+        wb2svg__strip_node* n = &s->nodes[g->nodes[i].slot];
+        if (n->parent != g->nodes[i].slot) continue;
+        n->index = graph.node_count;
+        graph.nodes[graph.node_count++] = (wb2svg_node){ .x = n->x, .y = n->y, .pixel_count = n->pixel_count, .component = 1 };
+    }
+    for (int i = 0; i < g->edge_count; ++i) {
+        const wb2svg__strip_edge* edge = &g->edges[i];
+        graph.edges[graph.edge_count++] = (wb2svg_edge){
+            .from = s->nodes[wb2svg__strip_node_find(s, edge->from)].index,
+            .to = s->nodes[wb2svg__strip_node_find(s, edge->to)].index,
+            .offset = edge->offset,
+            .count = edge->count,
+            .component = 1,
+            .color = edge->color,
+        };
+    }
+    if (!wb2svg__graph_adjacency(&graph)) return false;
+
+    wb2svg_component component = { .pixel_count = c->pixel_count, .color = wb2svg__strip_majority(c->counts) };
+    wb2svg_components components = { .items = &component, .count = 1, .capacity = 1 };
+    int begin = s->paths.count;
+    bool ok = wb2svg__trace_graph(&graph, &components, s->opts, &s->paths);
+    wb2svg__free(graph.adjacency);
+    if (!ok) return false;
+
+    if (s->w) return wb2svg__strip_write(s);
+    if (s->paths.count == begin) return true;
+    wb2svg__strip_done done = { .first = c->first, .begin = begin, .end = s->paths.count };
+    return WB2SVG__APPEND(s->done, s->done_count, s->done_capacity, done);
+}
+
+
+// Traces a component the rows have passed and recycles its slots.
+static bool wb2svg__strip_close(wb2svg__strips* s, int slot) {
+    wb2svg__strip_component* c = &s->components[slot];
+    // Too small components are dropped by tracing anyway.
+    if (c->pixel_count >= s->opts->min_component_size && !wb2svg__strip_trace(s, c)) return false;
+
+    wb2svg__strip_graph* g = &c->graph;
+    if (!WB2SVG__RESERVE(s->free_nodes, s->free_node_capacity, s->free_node_count + g->node_count)) return false;
+    for (int i = 0; i < g->node_count; ++i) s->free_nodes[s->free_node_count++] = g->nodes[i].slot;
+    g->node_count = 0;
+    g->edge_count = 0;
+    g->point_count = 0;
+    return WB2SVG__APPEND(s->free_slots, s->free_count, s->free_capacity, slot);
+}
+
+
+// Labels skeleton row y and adds it to the graph, then traces components
+// that ended above it. The rows above and below are in s->skeleton.
+static bool wb2svg__strip_add_row(wb2svg__strips* s, int y) {
+    const wb2svg_rgba* row = &s->skeleton[(size_t)(y % 3)*s->width];
+    int* previous = &s->labels[(size_t)((y + 1) & 1)*s->width];
+    int* current = &s->labels[(size_t)(y & 1)*s->width];
+
+    for (int x = 0; x < s->width; ++x) {
+        if (WB2SVG__IS_WHITE(row[x])) {
+            current[x] = -1;
+            continue;
+        }
+        // Already visited 8-neighbors: W, NW, N, NE.
+        int slot = x > 0 && current[x - 1] >= 0 ? wb2svg__strip_find(s, current[x - 1]) : -1;
+        if (y > 0) {
+            for (int nx = x - 1; nx <= x + 1; ++nx) {
+                if (nx < 0 || nx >= s->width || previous[nx] < 0) continue;
+                int neighbor = wb2svg__strip_find(s, previous[nx]);
+                slot = slot < 0 ? neighbor : wb2svg__strip_union(s, slot, neighbor);
+                if (slot < 0) return false;
+            }
+        }
+        if (slot < 0) {
+            slot = wb2svg__strip_new_component(s, x, y);
+            if (slot < 0) return false;
+        }
+
+        wb2svg__strip_component* c = &s->components[slot];
+        c->pixel_count++;
+        int color = wb2svg__palette_index(row[x]);
+        if (color >= 0) c->counts[color]++;
+        c->last_row = y;
+        current[x] = slot;
+        if (!wb2svg__strip_add_pixel(s, slot, x, y)) return false;
+    }
+    for (int x = 0; x < s->width; ++x) {
+        if (current[x] >= 0) current[x] = wb2svg__strip_find(s, current[x]);
+    }
+
+    // Components without pixels in this row are complete.
+    int open_count = 0;
+    for (int i = 0; i < s->open_count; ++i) {
+        int slot = s->open[i];
+        wb2svg__strip_component* c = &s->components[slot];
+        if (c->parent != slot) continue;
+        if (c->last_row < y) {
+            if (!wb2svg__strip_close(s, slot)) return false;
+            continue;
+        }
+        s->open[open_count++] = slot;
+    }
+    s->open_count = open_count;
+
+    for (int i = 0; i < s->merged_count; ++i) {
+        if (!WB2SVG__APPEND(s->free_slots, s->free_count, s->free_capacity, s->merged[i])) return false;
+    }
+    s->merged_count = 0;
+    return true;
+}
+
+
+static int wb2svg__run_strips(wb2svg__strips* s, wb2svg_read_func* read, void* read_context) {
+    int result = 0;
+    int width = s->width;
+    int height = s->height;
+    size_t row_size = (size_t)width*sizeof(wb2svg_rgba);
+    size_t strip_rows = s->strip_height + 2*WB2SVG__STRIP_OVERLAP;
+    wb2svg_rgba* source = wb2svg__malloc(strip_rows*row_size);
+    wb2svg_rgba* processed = wb2svg__malloc(strip_rows*row_size);
+    wb2svg_rgba* rows = wb2svg__malloc(wb2svg__row_scratch_size(width));
+    s->skeleton = wb2svg__malloc(3*row_size);
+    s->labels = wb2svg__malloc(2*(size_t)width*sizeof(int));
+    s->refs = wb2svg__malloc(2*(size_t)width*sizeof(int));
+    if (!source || !processed || !rows || !s->skeleton || !s->labels || !s->refs) WB2SVG__RETURN(-1);
+
+    // source holds rows [begin, end) of the image.
+    int begin = 0;
+    int end = 0;
+    for (int y0 = 0; y0 < height; y0 += s->strip_height) {
+        int y1 = y0 + s->strip_height < height ? y0 + s->strip_height : height;
+        int need_begin = y0 - WB2SVG__STRIP_OVERLAP > 0 ? y0 - WB2SVG__STRIP_OVERLAP : 0;
+        int need_end = y1 + WB2SVG__STRIP_OVERLAP < height ? y1 + WB2SVG__STRIP_OVERLAP : height;
+
+        if (need_begin > begin) {
+            memmove(source, source + (size_t)(need_begin - begin)*width, (end - need_begin)*row_size);
+            begin = need_begin;
+        }
+        if (need_end > end) {
+            if (read(read_context, source + (size_t)(end - begin)*width, need_end - end) < 0) WB2SVG__RETURN(-1);
+            end = need_end;
+        }
+
+        wb2svg_img strip = { .pixels = source, .width = width, .height = end - begin };
+        wb2svg_img strip_processed = { .pixels = processed, .width = width, .height = end - begin };
+        wb2svg__preprocess(strip, strip_processed, rows);
+        for (int y = y0; y < y1; ++y) {
+            memcpy(&s->skeleton[(size_t)(y % 3)*width], processed + (size_t)(y - begin)*width, row_size);
+            // Degrees of the row above are known now.
+            if (y > 0 && !wb2svg__strip_add_row(s, y - 1)) WB2SVG__RETURN(-1);
+        }
+    }
+    if (!wb2svg__strip_add_row(s, height - 1)) WB2SVG__RETURN(-1);
+
+    for (int i = 0; i < s->open_count; ++i) {
+        int slot = s->open[i];
+        if (s->components[slot].parent == slot && !wb2svg__strip_close(s, slot)) WB2SVG__RETURN(-1);
+    }
+    s->open_count = 0;
+
+defer:
+    wb2svg__free(rows);
+    wb2svg__free(processed);
+    wb2svg__free(source);
+    return result;
+}
+
+
+static int wb2svg__compare_strip_done(const void* a, const void* b) {
+    int64_t x = ((const wb2svg__strip_done*)a)->first, y = ((const wb2svg__strip_done*)b)->first;
+    return x < y ? -1 : x > y;
+}
+
+
+// Packs the collected paths in the order of wb2svg_trace: by components,
+// ordered by their first pixel, rather than by the row they end at.
+static bool wb2svg__strips_pack(wb2svg__strips* s, wb2svg_paths* paths) {
+    const wb2svg__path_builder* b = &s->paths;
+    qsort(s->done, s->done_count, sizeof(*s->done), wb2svg__compare_strip_done);
+    if (!wb2svg__alloc_paths(paths, s->width, s->height, b->count, b->point_count)) return false;
+    int count = 0;
+    int point_count = 0;
+    for (int k = 0; k < s->done_count; ++k) {
+        for (int i = s->done[k].begin; i < s->done[k].end; ++i) {
+            int offset = b->offsets[i];
+            int n = (i + 1 < b->count ? b->offsets[i + 1] : b->point_count) - offset;
+            memcpy(paths->points + point_count, b->points + offset, n*sizeof(wb2svg_point));
+            paths->offsets[count] = point_count;
+            paths->colors[count] = b->colors[i];
+            paths->kinds[count] = b->kinds[i];
+            point_count += n;
+            count++;
+        }
+    }
+    wb2svg__compute_bboxes(paths);
+    return true;
+}
+
+
+// Strip mode input box filtered as in wb2svg__downscale, one row at a time.
+typedef struct {
+    wb2svg_read_func* read;
+    void* context;
+    int width;  // Of the input
+    int height;
+    int factor;
+    int y;      // Next input row
+    wb2svg_rgba* row;
+    uint32_t* sums;
+} wb2svg__downscale_reader;
+
+
+static int wb2svg__read_downscaled(void* context, wb2svg_rgba* rows, int count) {
+    wb2svg__downscale_reader* r = context;
+    int width = wb2svg__downscaled(r->width, r->factor);
+    for (int i = 0; i < count; ++i) {
+        int n = r->height - r->y < r->factor ? r->height - r->y : r->factor;
+        for (int k = 0; k < n; ++k, ++r->y) {
+            if (r->read(r->context, r->row, 1) < 0) return -1;
+            wb2svg__downscale_add(r->row, r->width, r->factor, r->sums);
+        }
+        wb2svg__downscale_store(r->sums, r->width, r->factor, n, &rows[(size_t)i*width]);
+    }
+    return 0;
+}
+
+
+// With options downscale, puts r in front of *read and shrinks the size to
+// match. Free r->row after the conversion.
+static bool wb2svg__downscale_strips(
+    wb2svg__downscale_reader* r, const wb2svg_options* opts,
+    wb2svg_read_func** read, void** read_context, int* width, int* height
+) {
+    if (opts->downscale <= 1) return true;
+    *r = (wb2svg__downscale_reader){
+        .read = *read, .context = *read_context, .width = *width, .height = *height, .factor = opts->downscale,
+    };
+    size_t sums_size = (size_t)wb2svg__downscaled(*width, r->factor)*4*sizeof(uint32_t);
+    r->row = wb2svg__calloc(1, (size_t)*width*sizeof(wb2svg_rgba) + sums_size);
+    if (r->row == NULL) return false;
+    r->sums = (uint32_t*)&r->row[*width];
+    *read = wb2svg__read_downscaled;
+    *read_context = r;
+    *width = wb2svg__downscaled(*width, r->factor);
+    *height = wb2svg__downscaled(*height, r->factor);
+    return true;
+}
+
+
+// wb2svg_trace_strips with strip_height rows per strip.
+static int wb2svg__trace_strips(
+    wb2svg_read_func* read, void* read_context, int width, int height,
+    const wb2svg_options* options, int strip_height, wb2svg_paths* paths
+) {
+    *paths = (wb2svg_paths){0};
+    if (!read || width <= 0 || height <= 0 || strip_height <= 0) return -1;
+
+    wb2svg_options opts = options ? *options : wb2svg_default_options();
+    wb2svg__downscale_reader reader = {0};
+    if (!wb2svg__downscale_strips(&reader, &opts, &read, &read_context, &width, &height)) return -1;
+    wb2svg__strips s = { .width = width, .height = height, .strip_height = strip_height, .opts = &opts };
+    int result = wb2svg__run_strips(&s, read, read_context);
+    if (result == 0 && !wb2svg__strips_pack(&s, paths)) result = -1;
+    wb2svg__strips_free(&s);
+    wb2svg__free(reader.row);
+    return result;
+}
+
+
+int wb2svg_trace_strips(
+    wb2svg_read_func* read, void* read_context, int width, int height,
+    const wb2svg_options* options, wb2svg_paths* paths
+) {
+    return wb2svg__trace_strips(read, read_context, width, height, options, WB2SVG_STRIP_HEIGHT, paths);
+}
+
+
+int wb2svg_wb2svg_strips_to_func(
+    wb2svg_write_func* func, void* context, wb2svg_read_func* read, void* read_context,
+    int width, int height, const wb2svg_options* options
+) {
+    if (!func || !read || width <= 0 || height <= 0) return -1;
+
+    wb2svg_options opts = options ? *options : wb2svg_default_options();
+    if (opts.svg_grouping != WB2SVG_SVG_PATH_PER_CHAIN) {
+        wb2svg_paths paths;
+        if (wb2svg_trace_strips(read, read_context, width, height, &opts, &paths) < 0) return -1;
+        int result = wb2svg_paths_to_svg_func(func, context, &paths, &opts);
+        wb2svg_paths_free(&paths);
+        return result;
+    }
+
+    wb2svg__downscale_reader reader = {0};
+    if (!wb2svg__downscale_strips(&reader, &opts, &read, &read_context, &width, &height)) return -1;
+    char buffer[WB2SVG_WRITE_BUFFER_SIZE];
+    wb2svg__writer w = { .buffer = buffer, .capacity = sizeof(buffer), .func = func, .context = context };
+    wb2svg__strips s = {
+        .width = width, .height = height, .strip_height = WB2SVG_STRIP_HEIGHT, .opts = &opts,
+        .w = &w, .e = { .w = &w },
+    };
+    wb2svg__write_svg_open(&w, width, height);
+    int result = wb2svg__run_strips(&s, read, read_context);
+    wb2svg__strips_free(&s);
+    wb2svg__free(reader.row);
+    if (result < 0) return -1;
+    wb2svg__appendf(&w, "</svg>");
+    wb2svg__flush(&w);
+    return w.failed ? -1 : 0;
+}
+
+
+static uint8_t* wb2svg__put_varint(uint8_t* p, uint32_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+
+static uint32_t wb2svg__zigzag(int v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)-(int32_t)(v < 0);
+}
+
+
+static int wb2svg__unzigzag(uint32_t v) {
+    return (int)((v >> 1) ^ -(v & 1));
+}
+
+
+static int wb2svg__write_paths_bin(const wb2svg_paths* paths, wb2svg__writer* w) {
+    // Path tags: palette index and kind. The palette is the distinct colors in sorted order.
+    uint32_t* tags = wb2svg__malloc((paths->count + 1)*sizeof(uint32_t));
+    uint64_t* keys = tags ? wb2svg__sort_by_color(paths) : NULL;
+    if (keys == NULL) {
+        wb2svg__free(tags);
+        return -1;
+    }
+    int palette_size = 0;
+    for (int k = 0; k < paths->count; ++k) {
+        palette_size += k == 0 || keys[k] >> 32 != keys[k - 1] >> 32;
+    }
+
+    uint8_t* p = (uint8_t*)wb2svg__reserve_bytes(w, 5 + 5*5);
+    if (p != NULL) {
+        memcpy(p, "WB2B", 4);
+        p[4] = WB2SVG_BIN_VERSION;
+        p = wb2svg__put_varint(p + 5, (uint32_t)paths->width);
+        p = wb2svg__put_varint(p, (uint32_t)paths->height);
+        p = wb2svg__put_varint(p, (uint32_t)paths->count);
+        p = wb2svg__put_varint(p, (uint32_t)paths->point_count);
+        p = wb2svg__put_varint(p, (uint32_t)palette_size);
+        wb2svg__commit(w, (char*)p);
+    }
+    int index = -1;
+    for (int k = 0; k < paths->count; ++k) {
+        int i = (int)(uint32_t)keys[k];
+        if (k == 0 || keys[k] >> 32 != keys[k - 1] >> 32) {
+            index++;
+            p = (uint8_t*)wb2svg__reserve_bytes(w, 3);
+            if (p == NULL) break;
+            p[0] = paths->colors[i].r;
+            p[1] = paths->colors[i].g;
+            p[2] = paths->colors[i].b;
+            wb2svg__commit(w, (char*)p + 3);
+        }
+        tags[i] = (uint32_t)index*2 + (paths->kinds[i] == WB2SVG_PATH_CUBIC);
+    }
+    wb2svg__free(keys);
+
+    wb2svg_point last = {0};
+    for (int i = 0; i < paths->count && !w->failed; ++i) {
+        p = (uint8_t*)wb2svg__reserve_bytes(w, 2*5);
+        if (p == NULL) break;
+        p = wb2svg__put_varint(p, tags[i]);
+        p = wb2svg__put_varint(p, (uint32_t)(paths->offsets[i + 1] - paths->offsets[i]));
+        wb2svg__commit(w, (char*)p);
+
+        for (int j = paths->offsets[i]; j < paths->offsets[i + 1]; ++j) {
+            wb2svg_point q = paths->points[j];
+            p = (uint8_t*)wb2svg__reserve_bytes(w, 2*5);
+            if (p == NULL) break;
+            p = wb2svg__put_varint(p, wb2svg__zigzag(q.x - last.x));
+            p = wb2svg__put_varint(p, wb2svg__zigzag(q.y - last.y));
+            wb2svg__commit(w, (char*)p);
+            last = q;
+        }
+    }
+    wb2svg__free(tags);
+    wb2svg__flush(w);
+    return w->failed ? -1 : 0;
+}
+
+
+int wb2svg_paths_to_bin(const wb2svg_paths* paths, char* buffer, int buffer_size) {
+    if (!buffer || buffer_size <= 0) return -1;
+
+    wb2svg__writer w = { .buffer = buffer, .capacity = buffer_size };
+    if (wb2svg__write_paths_bin(paths, &w) < 0) return -1;
+    return w.count;
+}
+
+
+int wb2svg_paths_to_bin_func(wb2svg_write_func* func, void* context, const wb2svg_paths* paths) {
+    if (!func) return -1;
+
+    char buffer[WB2SVG_WRITE_BUFFER_SIZE];
+    wb2svg__writer w = { .buffer = buffer, .capacity = sizeof(buffer), .func = func, .context = context };
+    return wb2svg__write_paths_bin(paths, &w);
+}
+
+
+// Reads a varint of at most 5 bytes, returns NULL past the end or on overflow.
+static const uint8_t* wb2svg__get_varint(const uint8_t* p, const uint8_t* end, uint32_t* v) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            *v = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+
+int wb2svg_bin_decode(const void* data, int size, wb2svg_paths* paths) {
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + size;
+    *paths = (wb2svg_paths){0};
+
+    if (size < 5 || memcmp(p, "WB2B", 4) != 0 || p[4] != WB2SVG_BIN_VERSION) return -1;
+    p += 5;
+
+    uint32_t width, height, count, point_count;
+    if (!(p = wb2svg__get_varint(p, end, &width))) return -1;
+    if (!(p = wb2svg__get_varint(p, end, &height))) return -1;
+    if (!(p = wb2svg__get_varint(p, end, &count))) return -1;
+    if (!(p = wb2svg__get_varint(p, end, &point_count))) return -1;
+    if (width > INT_MAX || height > INT_MAX) return -1;
+    // Every path and point takes at least two bytes, which bounds the allocation.
+    if (count > (uint32_t)(end - p)/2 || point_count > (uint32_t)(end - p)/2) return -1;
+
+    uint32_t palette_size;
+    if (!(p = wb2svg__get_varint(p, end, &palette_size))) return -1;
+    if (palette_size > (uint32_t)(end - p)/3) return -1;
+    const uint8_t* palette = p;
+    p += palette_size*3;
+
+    if (!wb2svg__alloc_paths(paths, (int)width, (int)height, (int)count, (int)point_count)) return -1;
+
+    wb2svg_point last = {0};
+    int offset = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t tag, n;
+        if (!(p = wb2svg__get_varint(p, end, &tag))) goto malformed;
+        if (tag/2 >= palette_size) goto malformed;
+        if (!(p = wb2svg__get_varint(p, end, &n))) goto malformed;
+        if (n > point_count - (uint32_t)offset) goto malformed;
+
+        const uint8_t* color = palette + tag/2*3;
+        paths->offsets[i] = offset;
+        paths->colors[i] = (wb2svg_rgba){ color[0], color[1], color[2], 255 };
+        paths->kinds[i] = tag & 1 ? WB2SVG_PATH_CUBIC : WB2SVG_PATH_LINES;
+        for (uint32_t j = 0; j < n; ++j) {
+            uint32_t dx, dy;
+            if (!(p = wb2svg__get_varint(p, end, &dx))) goto malformed;
+            if (!(p = wb2svg__get_varint(p, end, &dy))) goto malformed;
+            // Wrapping instead of overflowing on hostile input.
+            last.x = (int)((uint32_t)last.x + (uint32_t)wb2svg__unzigzag(dx));
+            last.y = (int)((uint32_t)last.y + (uint32_t)wb2svg__unzigzag(dy));
+            paths->points[offset++] = last;
+        }
+    }
+    if (offset != (int)point_count) goto malformed;
+
+    wb2svg__compute_bboxes(paths);
+    return 0;
+
+malformed:
+    wb2svg_paths_free(paths);
+    return -1;
+}
+
+
+// Uniform grid over path endpoints for nearest neighbor queries. Each cell
+// keeps its live entries at the front of its range, used ones are dropped
+// lazily when a query visits the cell.
+typedef struct {
+    int x0, y0;
+    int cell_size;
+    int columns, rows;
+    int* cell_start;  // columns*rows + 1
+    int* cell_live;   // Live entries per cell
+    int* entries;     // path*2, plus 1 for the end point
+    int cells_capacity;
+    int live_capacity;
+    int entries_capacity;
+} wb2svg__grid;
+
+
+static wb2svg_point wb2svg__path_end_point(const wb2svg_paths* paths, int entry) {
+    int path = entry >> 1;
+    return paths->points[entry & 1 ? paths->offsets[path + 1] - 1 : paths->offsets[path]];
+}
+
+
+static int wb2svg__grid_cell(const wb2svg__grid* g, wb2svg_point p) {
+    int column = (p.x - g->x0)/g->cell_size;
+    int row = (p.y - g->y0)/g->cell_size;
+    if (column < 0) column = 0;
+    if (column >= g->columns) column = g->columns - 1;
+    if (row < 0) row = 0;
+    if (row >= g->rows) row = g->rows - 1;
+    return row*g->columns + column;
+}
+
+
+// Builds the grid over the endpoints of items, sized for about one entry per cell.
+static bool wb2svg__grid_build(
+    wb2svg__grid* g, const wb2svg_paths* paths, const int* items, int count, bool allow_reverse
+) {
+    int ends = allow_reverse ? 2 : 1;
+    wb2svg_bbox bbox = { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+    for (int i = 0; i < count; ++i) {
+        for (int end = 0; end < ends; ++end) {
+            wb2svg_point p = wb2svg__path_end_point(paths, items[i]*2 + end);
+            if (p.x < bbox.x0) bbox.x0 = p.x;
+            if (p.y < bbox.y0) bbox.y0 = p.y;
+            if (p.x > bbox.x1) bbox.x1 = p.x;
+            if (p.y > bbox.y1) bbox.y1 = p.y;
+        }
+    }
+    double area = ((double)bbox.x1 - bbox.x0 + 1)*((double)bbox.y1 - bbox.y0 + 1);
+    g->x0 = bbox.x0;
+    g->y0 = bbox.y0;
+    g->cell_size = (int)ceil(sqrt(area/(count*ends)));
+    if (g->cell_size < 1) g->cell_size = 1;
+    g->columns = (bbox.x1 - bbox.x0)/g->cell_size + 1;
+    g->rows = (bbox.y1 - bbox.y0)/g->cell_size + 1;
+
+    int cells = g->columns*g->rows;
+    if (!WB2SVG__RESERVE(g->cell_start, g->cells_capacity, cells + 1)) return false;
+    if (!WB2SVG__RESERVE(g->cell_live, g->live_capacity, cells)) return false;
+    if (!WB2SVG__RESERVE(g->entries, g->entries_capacity, count*ends)) return false;
+
+    // Counting sort of entries by cell.
+    memset(g->cell_live, 0, cells*sizeof(int));
+    for (int i = 0; i < count; ++i) {
+        for (int end = 0; end < ends; ++end) {
+            g->cell_live[wb2svg__grid_cell(g, wb2svg__path_end_point(paths, items[i]*2 + end))]++;
+        }
+    }
+    g->cell_start[0] = 0;
+    for (int c = 0; c < cells; ++c) g->cell_start[c + 1] = g->cell_start[c] + g->cell_live[c];
+    memset(g->cell_live, 0, cells*sizeof(int));
+    for (int i = 0; i < count; ++i) {
+        for (int end = 0; end < ends; ++end) {
+            int entry = items[i]*2 + end;
+            int c = wb2svg__grid_cell(g, wb2svg__path_end_point(paths, entry));
+            g->entries[g->cell_start[c] + g->cell_live[c]++] = entry;
+        }
+    }
+    return true;
+}
+
+
+// Nearest live entry to p, searching rings of cells around it until no
+// closer entry can remain. There must be at least one live entry.
+static int wb2svg__grid_nearest(wb2svg__grid* g, const wb2svg_paths* paths, const bool* used, wb2svg_point p) {
+    int center = wb2svg__grid_cell(g, p);
+    int cx = center % g->columns;
+    int cy = center / g->columns;
+    int best = -1;
+    int64_t best_d2 = INT64_MAX;
+    int max_ring = g->columns > g->rows ? g->columns : g->rows;
+    for (int ring = 0; ring <= max_ring; ++ring) {
+        for (int y = cy - ring; y <= cy + ring; ++y) {
+            if (y < 0 || y >= g->rows) continue;
+            // Inner rows of the ring only have their two edge cells.
+            int step = y == cy - ring || y == cy + ring ? 1 : 2*ring;
+            for (int x = cx - ring; x <= cx + ring; x += step > 0 ? step : 1) {
+                if (x < 0 || x >= g->columns) continue;
+                int c = y*g->columns + x;
+                int* entries = g->entries + g->cell_start[c];
+                for (int i = 0; i < g->cell_live[c];) {
+                    if (used[entries[i] >> 1]) {
+                        entries[i] = entries[--g->cell_live[c]];
+                        continue;
+                    }
+                    wb2svg_point q = wb2svg__path_end_point(paths, entries[i]);
+                    int64_t dx = q.x - p.x, dy = q.y - p.y;
+                    int64_t d2 = dx*dx + dy*dy;
+                    if (d2 < best_d2 || (d2 == best_d2 && entries[i] < best)) {
+                        best_d2 = d2;
+                        best = entries[i];
+                    }
+                    i++;
+                }
+            }
+        }
+        // Cells of the next ring are at least ring cells away.
+        int64_t reach = (int64_t)ring*g->cell_size;
+        if (best >= 0 && best_d2 <= reach*reach) break;
+    }
+    return best;
+}
+
+
+int wb2svg_paths_order_for_plotting(wb2svg_paths* paths, bool allow_reverse) {
+    int result = 0;
+    int n = paths->count;
+    uint64_t* keys = wb2svg__sort_by_color(paths);
+    int* items = wb2svg__malloc((n + 1)*sizeof(int));
+    int* order = wb2svg__malloc((n + 1)*sizeof(int)); // Entries: path*2 + reversed
+    bool* used = wb2svg__calloc(n + 1, sizeof(bool));
+    wb2svg__grid grid = {0};
+    wb2svg_paths sorted = {0};
+    if (!keys || !items || !order || !used) WB2SVG__RETURN(-1);
+
+    wb2svg_point pen = {0};
+    int ordered = 0;
+    for (int begin = 0; begin < n;) {
+        int end = begin;
+        while (end < n && keys[end] >> 32 == keys[begin] >> 32) end++;
+
+        int remaining = end - begin;
+        int built = remaining;
+        for (int i = 0; i < remaining; ++i) items[i] = (int)(uint32_t)keys[begin + i];
+        if (!wb2svg__grid_build(&grid, paths, items, remaining, allow_reverse)) WB2SVG__RETURN(-1);
+
+        while (remaining > 0) {
+            int entry = wb2svg__grid_nearest(&grid, paths, used, pen);
+            int path = entry >> 1;
+            used[path] = true;
+            order[ordered++] = entry;
+            // The pen ends where the path ends, or where it starts when reversed.
+            pen = wb2svg__path_end_point(paths, entry ^ 1);
+            remaining--;
+
+            // Rebuild coarser once most entries are gone, so queries do not
+            // scan rings of empty cells. Halving keeps the total cost linear.
+            if (remaining > 0 && remaining*4 < built) {
+                built = remaining;
+                int count = 0;
+                for (int i = begin; i < end; ++i) {
+                    int p = (int)(uint32_t)keys[i];
+                    if (!used[p]) items[count++] = p;
+                }
+                if (!wb2svg__grid_build(&grid, paths, items, count, allow_reverse)) WB2SVG__RETURN(-1);
+            }
+        }
+        begin = end;
+    }
+
+    if (!wb2svg__alloc_paths(&sorted, paths->width, paths->height, n, paths->point_count)) WB2SVG__RETURN(-1);
+    int offset = 0;
+    for (int i = 0; i < n; ++i) {
+        int path = order[i] >> 1;
+        bool reversed = allow_reverse && (order[i] & 1);
+        int first = paths->offsets[path];
+        int count = paths->offsets[path + 1] - first;
+        sorted.offsets[i] = offset;
+        sorted.colors[i] = paths->colors[path];
+        sorted.kinds[i] = paths->kinds[path];
+        sorted.bboxes[i] = paths->bboxes[path];
+        // Reversed cubic control points are still start, controls, end.
+        for (int j = 0; j < count; ++j) {
+            sorted.points[offset + j] = paths->points[first + (reversed ? count - 1 - j : j)];
+        }
+        offset += count;
+    }
+    wb2svg_paths_free(paths);
+    *paths = sorted;
+
+defer:
+    wb2svg__free(keys);
+    wb2svg__free(items);
+    wb2svg__free(order);
+    wb2svg__free(used);
+    wb2svg__free(grid.cell_start);
+    wb2svg__free(grid.cell_live);
+    wb2svg__free(grid.entries);
+    return result;
+}
+
+
+// Path points with cubic segments flattened into lines, in scratch if needed.
+static const wb2svg_point* wb2svg__flatten_path(
+    const wb2svg_paths* paths, int path, wb2svg_point** scratch, int* scratch_capacity, int* count
+) {
+    const wb2svg_point* points = paths->points + paths->offsets[path];
+    *count = paths->offsets[path + 1] - paths->offsets[path];
+    if (paths->kinds[path] != WB2SVG_PATH_CUBIC) return points;
+
+    int flat = 0;
+    if (!WB2SVG__APPEND(*scratch, flat, *scratch_capacity, points[0])) return NULL;
+    for (int i = 1; i + 2 < *count; i += 3) {
+        wb2svg__vec2 b[4] = {
+            wb2svg__vec2_of(points[i - 1]), wb2svg__vec2_of(points[i]),
+            wb2svg__vec2_of(points[i + 1]), wb2svg__vec2_of(points[i + 2]),
+        };
+        // About one step per 2 pixels along the control polygon.
+        float length = wb2svg__vec2_len(wb2svg__vec2_sub(b[1], b[0]))
+                     + wb2svg__vec2_len(wb2svg__vec2_sub(b[2], b[1]))
+                     + wb2svg__vec2_len(wb2svg__vec2_sub(b[3], b[2]));
+        int steps = (int)ceilf(length/2);
+        if (steps < 1) steps = 1;
+        if (steps > 32) steps = 32;
+        for (int k = 1; k <= steps; ++k) {
+            wb2svg__vec2 v = wb2svg__bezier_at(b, (float)k/steps);
+            wb2svg_point q = { (int)lroundf(v.x), (int)lroundf(v.y) };
+            if (q.x == (*scratch)[flat - 1].x && q.y == (*scratch)[flat - 1].y) continue;
+            if (!WB2SVG__APPEND(*scratch, flat, *scratch_capacity, q)) return NULL;
+        }
+    }
+    *count = flat;
+    return *scratch;
+}
+
+
+static int wb2svg__write_paths_hpgl(const wb2svg_paths* paths, wb2svg__writer* w) {
+    wb2svg_point* scratch = NULL;
+    int scratch_capacity = 0;
+    wb2svg_rgba pens[8];
+    int pen_count = 0;
+    int pen = 0;
+
+    wb2svg__appendf(w, "IN;\n");
+    for (int i = 0; i < paths->count && !w->failed; ++i) {
+        wb2svg_rgba c = paths->colors[i];
+        int index = 0;
+        while (index < pen_count && memcmp(&pens[index], &c, sizeof(c)) != 0) index++;
+        if (index == pen_count && pen_count < 8) pens[pen_count++] = c;
+        // Pens beyond the carousel's 8 share the last one.
+        if (index == 8) index = 7;
+        if (index + 1 != pen) {
+            pen = index + 1;
+            wb2svg__appendf(w, "SP%d;\n", pen);
+        }
+
+        int count;
+        const wb2svg_point* points = wb2svg__flatten_path(paths, i, &scratch, &scratch_capacity, &count);
+        if (points == NULL) {
+            w->failed = true;
+            break;
+        }
+        for (int j = 0; j < count; ++j) {
+            char* p = wb2svg__reserve_bytes(w, 4 + 2*12 + 2);
+            if (p == NULL) break;
+            p = j == 0 ? WB2SVG__WRITE_LITERAL(p, "PU") : j == 1 ? WB2SVG__WRITE_LITERAL(p, "PD") : p;
+            if (j > 1) *p++ = ',';
+            p = wb2svg__write_int(p, points[j].x*WB2SVG_HPGL_UNITS_PER_PIXEL);
+            *p++ = ',';
+            p = wb2svg__write_int(p, (paths->height - points[j].y)*WB2SVG_HPGL_UNITS_PER_PIXEL);
+            if (j == 0) *p++ = ';';
+            wb2svg__commit(w, p);
+        }
+        // A single point is a dot, the pen goes down in place.
+        wb2svg__appendf(w, count == 1 ? "PD;\n" : ";\n");
+    }
+    wb2svg__appendf(w, "PU;SP0;\n");
+    wb2svg__flush(w);
+    wb2svg__free(scratch);
+    return w->failed ? -1 : 0;
+}
+
+
+int wb2svg_paths_to_hpgl_func(wb2svg_write_func* func, void* context, const wb2svg_paths* paths) {
+    if (!func) return -1;
+
+    char buffer[WB2SVG_WRITE_BUFFER_SIZE];
+    wb2svg__writer w = { .buffer = buffer, .capacity = sizeof(buffer), .func = func, .context = context };
+    return wb2svg__write_paths_hpgl(paths, &w);
+}
+
+
+// AutoCAD color index: 1 red, 3 green, 5 blue, 7 black or white by background.
+static int wb2svg__dxf_color(wb2svg_rgba c) {
+    if (c.r > c.g && c.r > c.b) return 1;
+    if (c.g > c.r && c.g > c.b) return 3;
+    if (c.b > c.r && c.b > c.g) return 5;
+    return 7;
+}
+
+
+static void wb2svg__dxf_vertex(wb2svg__writer* w, const char* entity, wb2svg_point p, int height) {
+    wb2svg__appendf(w, "0\n%s\n8\n0\n", entity);
+    char* s = wb2svg__reserve_bytes(w, 2*(4 + 12));
+    if (s == NULL) return;
+    s = WB2SVG__WRITE_LITERAL(s, "10\n");
+    s = wb2svg__write_int(s, p.x);
+    s = WB2SVG__WRITE_LITERAL(s, "\n20\n");
+    s = wb2svg__write_int(s, height - p.y);
+    *s++ = '\n';
+    wb2svg__commit(w, s);
+}
+
+
+static int wb2svg__write_paths_dxf(const wb2svg_paths* paths, wb2svg__writer* w) {
+    wb2svg_point* scratch = NULL;
+    int scratch_capacity = 0;
+
+    // R12 readers accept a file with only the entities section.
+    wb2svg__appendf(w, "0\nSECTION\n2\nENTITIES\n");
+    for (int i = 0; i < paths->count && !w->failed; ++i) {
+        int count;
+        const wb2svg_point* points = wb2svg__flatten_path(paths, i, &scratch, &scratch_capacity, &count);
+        if (points == NULL) {
+            w->failed = true;
+            break;
+        }
+        int color = wb2svg__dxf_color(paths->colors[i]);
+        if (count == 1) {
+            wb2svg__dxf_vertex(w, "POINT", points[0], paths->height);
+            wb2svg__appendf(w, "62\n%d\n", color);
+            continue;
+        }
+        wb2svg__appendf(w, "0\nPOLYLINE\n8\n0\n62\n%d\n66\n1\n10\n0\n20\n0\n70\n0\n", color);
+        for (int j = 0; j < count && !w->failed; ++j) {
+            wb2svg__dxf_vertex(w, "VERTEX", points[j], paths->height);
+        }
+        wb2svg__appendf(w, "0\nSEQEND\n8\n0\n");
+    }
+    wb2svg__appendf(w, "0\nENDSEC\n0\nEOF\n");
+    wb2svg__flush(w);
+    wb2svg__free(scratch);
+    return w->failed ? -1 : 0;
+}
+
+
+int wb2svg_paths_to_dxf_func(wb2svg_write_func* func, void* context, const wb2svg_paths* paths) {
+    if (!func) return -1;
+
+    char buffer[WB2SVG_WRITE_BUFFER_SIZE];
+    wb2svg__writer w = { .buffer = buffer, .capacity = sizeof(buffer), .func = func, .context = context };
+    return wb2svg__write_paths_dxf(paths, &w);
+}
+
+
+#ifdef WB2SVG_SVGZ
+
+// Deflate window: matches reach back this far, and the SVG is compressed
+// in pieces of at most this size.
+#define WB2SVG__DEFLATE_WINDOW 32768
+#define WB2SVG__DEFLATE_HASH_SIZE 32768
+
+
+// Writes a single gzip member (RFC 1952) holding one deflate stream
+// (RFC 1951), compressed as the SVG is generated: every chunk from the
+// writer becomes a non-final fixed Huffman block, matches reach back into
+// earlier chunks, and an empty final block ends the stream.
+typedef struct {
+    wb2svg_write_func* func;
+    void* context;
+    int max_chain;     // Earlier positions tried per match
+    bool failed;
+    uint32_t crc;      // Running CRC-32 and size of the SVG for the trailer
+    uint32_t size;
+    uint32_t bits;     // Pending output bits, least significant first
+    int bit_count;
+    uint8_t* window;   // 2*WB2SVG__DEFLATE_WINDOW bytes: history, then the piece being compressed
+    int window_count;
+    int* head;         // Latest window position per hash of 3 bytes, -1 for none
+    int* prev;         // Previous position with the same hash, by position % WB2SVG__DEFLATE_WINDOW
+    uint8_t out[WB2SVG_WRITE_BUFFER_SIZE];
+    int out_count;
+    uint32_t crc_table[256];
+} wb2svg__gzip;
+
+
+static void wb2svg__put_u32le(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+
+static void wb2svg__gzip_flush(wb2svg__gzip* z) {
+    if (z->out_count > 0) z->func(z->context, z->out, z->out_count);
+    z->out_count = 0;
+}
+
+
+static void wb2svg__gzip_byte(wb2svg__gzip* z, uint8_t byte) {
+    if (z->out_count == (int)sizeof(z->out)) wb2svg__gzip_flush(z);
+    z->out[z->out_count++] = byte;
+}
+
+
+// Appends count (up to 16) bits of value, least significant first.
+static void wb2svg__gzip_bits(wb2svg__gzip* z, uint32_t value, int count) {
+    z->bits |= value << z->bit_count;
+    z->bit_count += count;
+    while (z->bit_count >= 8) {
+        wb2svg__gzip_byte(z, (uint8_t)z->bits);
+        z->bits >>= 8;
+        z->bit_count -= 8;
+    }
+}
+
+
+// Huffman codes are packed most significant bit first.
+static void wb2svg__gzip_code(wb2svg__gzip* z, uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; ++i) reversed |= (code >> i & 1) << (length - 1 - i);
+    wb2svg__gzip_bits(z, reversed, length);
+}
+
+
+// Literal/length symbol with the fixed Huffman code.
+static void wb2svg__gzip_symbol(wb2svg__gzip* z, int symbol) {
+    if (symbol < 144) wb2svg__gzip_code(z, 0x30 + symbol, 8);
+    else if (symbol < 256) wb2svg__gzip_code(z, 0x190 + symbol - 144, 9);
+    else if (symbol < 280) wb2svg__gzip_code(z, symbol - 256, 7);
+    else wb2svg__gzip_code(z, 0xC0 + symbol - 280, 8);
+}
+
+
+static void wb2svg__gzip_match(wb2svg__gzip* z, int length, int distance) {
+    static const uint16_t length_base[30] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+        67, 83, 99, 115, 131, 163, 195, 227, 258, 259,
+    };
+    static const uint8_t length_extra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+    };
+    static const uint16_t distance_base[31] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+        1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577, 32769,
+    };
+    static const uint8_t distance_extra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+    };
+
+    int j = 0;
+    while (length >= length_base[j + 1]) j++;
+    wb2svg__gzip_symbol(z, 257 + j);
+    wb2svg__gzip_bits(z, length - length_base[j], length_extra[j]);
+    j = 0;
+    while (distance >= distance_base[j + 1]) j++;
+    wb2svg__gzip_code(z, j, 5);
+    wb2svg__gzip_bits(z, distance - distance_base[j], distance_extra[j]);
+}
+
+
+static int wb2svg__gzip_hash(const uint8_t* p) {
+    return (p[0] << 10 ^ p[1] << 5 ^ p[2]) & (WB2SVG__DEFLATE_HASH_SIZE - 1);
+}
+
+
+static void wb2svg__gzip_insert(wb2svg__gzip* z, int position) {
+    int h = wb2svg__gzip_hash(z->window + position);
+    z->prev[position % WB2SVG__DEFLATE_WINDOW] = z->head[h];
+    z->head[h] = position;
+}
+
+
+// Compresses window[start..window_count) as one fixed Huffman block, greedily
+// taking the longest match among the max_chain latest with the same hash.
+static void wb2svg__gzip_block(wb2svg__gzip* z, int start) {
+    const uint8_t* window = z->window;
+    int end = z->window_count;
+
+    wb2svg__gzip_bits(z, 0, 1); // BFINAL
+    wb2svg__gzip_bits(z, 1, 2); // BTYPE fixed Huffman
+    for (int i = start; i < end;) {
+        int best = 0, best_distance = 0;
+        if (i + 3 <= end) {
+            int limit = end - i < 258 ? end - i : 258;
+            int candidate = z->head[wb2svg__gzip_hash(window + i)];
+            for (int chain = z->max_chain; chain > 0 && candidate >= 0; --chain) {
+                if (i - candidate > WB2SVG__DEFLATE_WINDOW) break;
+                int length = 0;
+                while (length < limit && window[candidate + length] == window[i + length]) length++;
+                if (length > best) {
+                    best = length;
+                    best_distance = i - candidate;
+                    if (length == limit) break;
+                }
+                candidate = z->prev[candidate % WB2SVG__DEFLATE_WINDOW];
+            }
+            wb2svg__gzip_insert(z, i);
+        }
+        if (best >= 3) {
+            wb2svg__gzip_match(z, best, best_distance);
+            for (int k = i + 1; k < i + best && k + 3 <= end; ++k) wb2svg__gzip_insert(z, k);
+            i += best;
+        } else {
+            wb2svg__gzip_symbol(z, window[i]);
+            i++;
+        }
+    }
+    wb2svg__gzip_symbol(z, 256); // End of block
+}
+
+
+// wb2svg_write_func compressing each chunk of SVG as it is written.
+static void wb2svg__gzip_write(void* context, void* data, int size) {
+    wb2svg__gzip* z = (wb2svg__gzip*)context;
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (int i = 0; i < size; ++i) {
+        z->crc = z->crc_table[(z->crc ^ bytes[i]) & 0xFF] ^ (z->crc >> 8);
+    }
+    z->size += (uint32_t)size;
+
+    while (size > 0) {
+        int piece = size < WB2SVG__DEFLATE_WINDOW ? size : WB2SVG__DEFLATE_WINDOW;
+        if (z->window_count + piece > 2*WB2SVG__DEFLATE_WINDOW) {
+            // Keep the latest window of history, positions move down with it.
+            memcpy(z->window, z->window + WB2SVG__DEFLATE_WINDOW, WB2SVG__DEFLATE_WINDOW);
+            z->window_count -= WB2SVG__DEFLATE_WINDOW;
+            for (int i = 0; i < WB2SVG__DEFLATE_HASH_SIZE; ++i) {
+                z->head[i] = z->head[i] >= WB2SVG__DEFLATE_WINDOW ? z->head[i] - WB2SVG__DEFLATE_WINDOW : -1;
+            }
+            for (int i = 0; i < WB2SVG__DEFLATE_WINDOW; ++i) {
+                z->prev[i] = z->prev[i] >= WB2SVG__DEFLATE_WINDOW ? z->prev[i] - WB2SVG__DEFLATE_WINDOW : -1;
+            }
+        }
+        int start = z->window_count;
+        memcpy(z->window + start, bytes, piece);
+        z->window_count += piece;
+        wb2svg__gzip_block(z, start);
+        bytes += piece;
+        size -= piece;
+    }
+    wb2svg__gzip_flush(z);
+}
+
+
+int wb2svg_wb2svgz_to_func(wb2svg_write_func* func, void* context, wb2svg_img img, const wb2svg_options* options, int level) {
+    if (!func) return -1;
+
+    int result = -1;
+    wb2svg__gzip* z = wb2svg__calloc(1, sizeof(wb2svg__gzip));
+    if (z == NULL) WB2SVG__RETURN(-1);
+    z->window = wb2svg__malloc(2*WB2SVG__DEFLATE_WINDOW);
+    z->head = wb2svg__malloc(WB2SVG__DEFLATE_HASH_SIZE*sizeof(int));
+    z->prev = wb2svg__malloc(WB2SVG__DEFLATE_WINDOW*sizeof(int));
+    if (!z->window || !z->head || !z->prev) WB2SVG__RETURN(-1);
+    for (int i = 0; i < WB2SVG__DEFLATE_HASH_SIZE; ++i) z->head[i] = -1;
+
+    z->func = func;
+    z->context = context;
+    z->max_chain = level < 1 ? 1 : level;
+    z->crc = 0xFFFFFFFFu;
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        z->crc_table[i] = c;
+    }
+
+    // Deflate, no flags or mtime, unknown OS.
+    static const uint8_t header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+    for (int i = 0; i < (int)sizeof(header); ++i) wb2svg__gzip_byte(z, header[i]);
+
+    char buffer[WB2SVG_WRITE_BUFFER_SIZE];
+    wb2svg__writer w = { .buffer = buffer, .capacity = sizeof(buffer), .func = wb2svg__gzip_write, .context = z };
+    if (wb2svg__write_svg(img, options, &w) < 0) WB2SVG__RETURN(-1);
+
+    // Empty final block, padded to a byte.
+    wb2svg__gzip_bits(z, 1, 1);
+    wb2svg__gzip_bits(z, 1, 2);
+    wb2svg__gzip_symbol(z, 256);
+    if (z->bit_count > 0) wb2svg__gzip_bits(z, 0, 8 - z->bit_count);
+    uint8_t trailer[8];
+    wb2svg__put_u32le(trailer, ~z->crc);
+    wb2svg__put_u32le(trailer + 4, z->size);
+    for (int i = 0; i < (int)sizeof(trailer); ++i) wb2svg__gzip_byte(z, trailer[i]);
+    wb2svg__gzip_flush(z);
+    result = 0;
+
+defer:
+    if (z) {
+        wb2svg__free(z->prev);
+        wb2svg__free(z->head);
+        wb2svg__free(z->window);
+    }
+    wb2svg__free(z);
+    return result;
+}
+
+#endif // WB2SVG_SVGZ
+
+
+#ifdef WB2SVG_PDF
+
+// Define WB2SVG_ZLIB_COMPRESS to use another zlib-style compressor (and
+// WB2SVG_ZLIB_FREE to release its output), by default the one from
+// stb_image_write.h's implementation is linked. Its output is released with
+// STBIW_FREE when stb_image_write.h's implementation comes first in this
+// file, so STBIW_MALLOC and friends defined as wb2svg_malloc and friends
+// keep it in wb2svg's allocator and arena.
+#ifndef WB2SVG_ZLIB_COMPRESS
+unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+#define WB2SVG_ZLIB_COMPRESS stbi_zlib_compress
+#endif
+#ifndef WB2SVG_ZLIB_FREE
+#ifdef STBIW_FREE
+#define WB2SVG_ZLIB_FREE(pointer) STBIW_FREE(pointer)
+#else
+#define WB2SVG_ZLIB_FREE free
+#endif
+#endif
+
+
+typedef struct {
+    wb2svg_write_func* func;
+    void* context;
+    int written;    // Bytes handed to func, for the cross-reference table
+    wb2svg__writer out;
+    int* offsets;   // Per object, offsets[0] is unused
+    int object_count;
+    int offsets_capacity;
+    bool failed;
+} wb2svg__pdf;
+
+
+static void wb2svg__pdf_write(void* context, void* data, int size) {
+    wb2svg__pdf* pdf = (wb2svg__pdf*)context;
+    pdf->func(pdf->context, data, size);
+    pdf->written += size;
+}
+
+
+// Starts the next object at the current output position, returns its number.
+static int wb2svg__pdf_begin_object(wb2svg__pdf* pdf) {
+    int object = pdf->object_count + 1;
+    if (!WB2SVG__RESERVE(pdf->offsets, pdf->offsets_capacity, object + 1)) {
+        pdf->failed = true;
+        return object;
+    }
+    pdf->offsets[object] = pdf->written + pdf->out.count;
+    pdf->object_count = object;
+    wb2svg__appendf(&pdf->out, "%d 0 obj\n", object);
+    return object;
+}
+
+
+// Compresses a chunk of drawing operators into its own content stream.
+static void wb2svg__pdf_content(void* context, void* data, int size) {
+    wb2svg__pdf* pdf = (wb2svg__pdf*)context;
+    if (pdf->failed) return;
+
+    int zlib_size = 0;
+    unsigned char* zlib = WB2SVG_ZLIB_COMPRESS((unsigned char*)data, size, &zlib_size, 8);
+    if (zlib == NULL) {
+        pdf->failed = true;
+        return;
+    }
+    wb2svg__pdf_begin_object(pdf);
+    wb2svg__appendf(&pdf->out, "<</Length %d/Filter/FlateDecode>>\nstream\n", zlib_size);
+    wb2svg__flush(&pdf->out);
+    wb2svg__pdf_write(pdf, zlib, zlib_size);
+    wb2svg__appendf(&pdf->out, "\nendstream\nendobj\n");
+    WB2SVG_ZLIB_FREE(zlib);
+}
+
+
+// Writes "x y " followed by the operator and a space, if any.
+static void wb2svg__pdf_point(wb2svg__writer* w, wb2svg_point p, char op) {
+    char* s = wb2svg__reserve_bytes(w, 2*12 + 2);
+    if (s == NULL) return;
+    s = wb2svg__write_int(s, p.x);
+    *s++ = ' ';
+    s = wb2svg__write_int(s, p.y);
+    *s++ = ' ';
+    if (op) {
+        *s++ = op;
+        *s++ = ' ';
+    }
+    wb2svg__commit(w, s);
+}
+
+
+int wb2svg_paths_to_pdf_func(wb2svg_write_func* func, void* context, const wb2svg_paths* paths) {
+    if (!func) return -1;
+
+    int result = 0;
+    wb2svg__pdf pdf = { .func = func, .context = context };
+    char out_buffer[WB2SVG_WRITE_BUFFER_SIZE];
+    pdf.out = (wb2svg__writer){
+        .buffer = out_buffer, .capacity = sizeof(out_buffer),
+        .func = wb2svg__pdf_write, .context = &pdf
+    };
+    wb2svg__writer content = { .func = wb2svg__pdf_content, .context = &pdf };
+    content.buffer = wb2svg__malloc(WB2SVG_PDF_CHUNK_SIZE);
+    content.capacity = WB2SVG_PDF_CHUNK_SIZE;
+    if (content.buffer == NULL) WB2SVG__RETURN(-1);
+
+    // Binary comment marks the file as binary for transfer tools.
+    wb2svg__appendf(&pdf.out, "%%PDF-1.4\n%%\xE2\xE3\xCF\xD3\n");
+    // Catalog and page tree are written last, reserve their numbers.
+    pdf.object_count = 2;
+
+    // Flip to image coordinates, round caps and joins draw single pixels as dots.
+    wb2svg__appendf(&content, "1 0 0 -1 0 %d cm 1 J 1 j\n", paths->height);
+    wb2svg_rgba color = { 0, 0, 0, 0 };
+    for (int i = 0; i < paths->count && !content.failed && !pdf.failed; ++i) {
+        wb2svg_rgba c = paths->colors[i];
+        if (i == 0 || c.r != color.r || c.g != color.g || c.b != color.b) {
+            wb2svg__appendf(&content, "%.3g %.3g %.3g RG\n", c.r/255.0, c.g/255.0, c.b/255.0);
+            color = c;
+        }
+
+        const wb2svg_point* points = paths->points + paths->offsets[i];
+        int count = paths->offsets[i + 1] - paths->offsets[i];
+        wb2svg__pdf_point(&content, points[0], 'm');
+        if (count == 1) {
+            wb2svg__pdf_point(&content, points[0], 'l');
+        } else if (paths->kinds[i] == WB2SVG_PATH_CUBIC) {
+            for (int j = 1; j + 2 < count; j += 3) {
+                wb2svg__pdf_point(&content, points[j], 0);
+                wb2svg__pdf_point(&content, points[j + 1], 0);
+                wb2svg__pdf_point(&content, points[j + 2], 'c');
+            }
+        } else {
+            for (int j = 1; j < count; ++j) wb2svg__pdf_point(&content, points[j], 'l');
+        }
+        wb2svg__appendf(&content, "S\n");
+    }
+    wb2svg__flush(&content);
+    if (content.failed || pdf.failed) WB2SVG__RETURN(-1);
+
+    int first_content = 3;
+    int last_content = pdf.object_count;
+    int page = wb2svg__pdf_begin_object(&pdf);
+    wb2svg__appendf(
+        &pdf.out, "<</Type/Page/Parent 2 0 R/MediaBox[0 0 %d %d]/Contents[",
+        paths->width, paths->height
+    );
+    for (int object = first_content; object <= last_content; ++object) {
+        wb2svg__appendf(&pdf.out, object > first_content ? " %d 0 R" : "%d 0 R", object);
+    }
+    wb2svg__appendf(&pdf.out, "]>>\nendobj\n");
+    if (pdf.failed) WB2SVG__RETURN(-1);
+
+    pdf.offsets[1] = pdf.written + pdf.out.count;
+    wb2svg__appendf(&pdf.out, "1 0 obj\n<</Type/Catalog/Pages 2 0 R>>\nendobj\n");
+    pdf.offsets[2] = pdf.written + pdf.out.count;
+    wb2svg__appendf(&pdf.out, "2 0 obj\n<</Type/Pages/Kids[%d 0 R]/Count 1>>\nendobj\n", page);
+
+    int xref = pdf.written + pdf.out.count;
+    wb2svg__appendf(&pdf.out, "xref\n0 %d\n0000000000 65535 f\r\n", pdf.object_count + 1);
+    for (int object = 1; object <= pdf.object_count; ++object) {
+        wb2svg__appendf(&pdf.out, "%010d 00000 n\r\n", pdf.offsets[object]);
+    }
+    wb2svg__appendf(
+        &pdf.out, "trailer\n<</Size %d/Root 1 0 R>>\nstartxref\n%d\n%%%%EOF\n",
+        pdf.object_count + 1, xref
+    );
+    wb2svg__flush(&pdf.out);
+    if (pdf.out.failed) WB2SVG__RETURN(-1);
+
+defer:
+    wb2svg__free(content.buffer);
+    wb2svg__free(pdf.offsets);
+    return result;
+}
+
+#endif // WB2SVG_PDF
+
+
+char* wb2svg_wb2svg_alloc(wb2svg_img img, const wb2svg_options* options, int capacity_hint, int* length) {
+    wb2svg__writer w = { .grow = true };
+    if (capacity_hint > 0 && !WB2SVG__RESERVE(w.buffer, w.capacity, capacity_hint)) return NULL;
+    if (wb2svg__write_svg(img, options, &w) < 0) {
+        wb2svg__free(w.buffer);
+        return NULL;
+    }
+    w.buffer[w.count] = '\0';
+    if (length) *length = w.count;
+    return w.buffer;
+}
+
+
+#if !defined(WB2SVG_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define WB2SVG__MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+int wb2svg_file_open(wb2svg_file* file, const char* file_path) {
+    static const uint8_t empty[1];
+    *file = (wb2svg_file){0};
+
+#ifdef WB2SVG__MMAP
+    int fd = open(file_path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size > INT_MAX) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        file->data = empty;
+        return 0;
+    }
+    void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped != MAP_FAILED) {
+#ifdef POSIX_MADV_SEQUENTIAL
+        // Decoders read front to back: read ahead further, drop pages behind.
+        posix_madvise(mapped, st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+        file->data = mapped;
+        file->size = (int)st.st_size;
+        file->mapped = true;
+        return 0;
+    }
+#endif // WB2SVG__MMAP
+
+    // Mapping failed, read it instead
+    int result = 0;
+    uint8_t* data = NULL;
+    FILE* f = fopen(file_path, "rb");
+    if (f == NULL) return -1;
+    if (fseek(f, 0, SEEK_END) != 0) WB2SVG__RETURN(-1);
+    long length = ftell(f);
+    if (length < 0 || length > INT_MAX || fseek(f, 0, SEEK_SET) != 0) WB2SVG__RETURN(-1);
+    if (length == 0) {
+        file->data = empty;
+        WB2SVG__RETURN(0);
+    }
+    data = wb2svg__malloc(length);
+    if (data == NULL || fread(data, 1, length, f) != (size_t)length) WB2SVG__RETURN(-1);
+    file->data = data;
+    file->size = (int)length;
+    data = NULL;
+
+defer:
+    wb2svg__free(data);
+    fclose(f);
+    return result;
+}
+
+
+void wb2svg_file_close(wb2svg_file* file) {
+#ifdef WB2SVG__MMAP
+    if (file->mapped) munmap((void*)file->data, file->size);
+#endif
+    if (!file->mapped && file->size > 0) wb2svg__free((void*)file->data);
+    *file = (wb2svg_file){0};
+}
+
 #endif // WB2SVG_IMPLEMENTATION